@@ -0,0 +1,278 @@
+/*
+ * Batch runner: executes many ROMs, each in its own Cpu, across a pool of
+ * threads.
+ *
+ *   cc -O2 -pthread -o batch batch.c cpu.c disasm.c rom.c
+ *   ./batch [-j threads] [-n instructions] [-c cycles] [-v] rom...
+ *
+ * Every ROM runs until BRK, an illegal opcode or one of the budgets is
+ * reached. Jobs are split into one contiguous range per worker; a worker
+ * that finishes its range steals from the others, so a few slow ROMs don't
+ * leave the rest of the pool idle. Cpu contexts share nothing, so the only
+ * synchronization is the per-range job counter. ROMs are mapped from their
+ * files rather than read, so a job costs no copy of the image.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "rom.h"
+
+#define BATCH_INSTRUCTIONS 10000000
+#define BATCH_MAX_THREADS 256
+
+typedef struct _job {
+    const char *path;
+    CpuStopReason stop;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint16_t pc;
+    bool failed;
+} Job;
+
+typedef struct _range {
+    atomic_size_t next;
+    size_t end;
+    // Keeps each counter on its own cache line.
+    char padding[64 - sizeof(atomic_size_t) - sizeof(size_t)];
+} Range;
+
+typedef struct _batch {
+    Job *jobs;
+    Range *ranges;
+    int workers;
+    uint64_t maxInstructions;
+    uint64_t maxCycles;
+} Batch;
+
+typedef struct _worker {
+    Batch *batch;
+    int index;
+    pthread_t thread;
+} Worker;
+
+static const char *batch_stopNames[] = {
+    [CPU_STOP_NONE] = "none",
+    [CPU_STOP_INSTRUCTIONS] = "instructions",
+    [CPU_STOP_CYCLES] = "cycles",
+    [CPU_STOP_BRK] = "brk",
+    [CPU_STOP_BREAKPOINT] = "breakpoint",
+    [CPU_STOP_ILLEGAL] = "illegal",
+};
+
+static double batch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void batch_runJob(Batch *batch, Job *job, Cpu *cpu) {
+    Rom rom;
+
+    if (rom_open(&rom, job->path) < 0) {
+        job->failed = true;
+        return;
+    }
+
+    cpu_initialize(cpu);
+    if (rom_map(&rom, cpu) < 0) {
+        job->failed = true;
+    } else {
+        job->instructions = cpu_run(cpu, batch->maxInstructions,
+                batch->maxCycles, &job->stop);
+        job->cycles = cpu->cycles;
+        job->pc = cpu->pc;
+    }
+
+    cpu_release(cpu);
+    rom_close(&rom);
+}
+
+// Claims the next job of a range, or returns false once it's drained. The
+// owner and any thieves race on the same counter, so every index is handed
+// out exactly once.
+static bool batch_claim(Range *range, size_t *index) {
+    if (atomic_load_explicit(&range->next, memory_order_relaxed)
+            >= range->end) {
+        return false;
+    }
+
+    *index = atomic_fetch_add_explicit(&range->next, 1,
+            memory_order_relaxed);
+    return *index < range->end;
+}
+
+static void *batch_work(void *arg) {
+    Worker *worker = arg;
+    Batch *batch = worker->batch;
+    Cpu *cpu = malloc(sizeof(Cpu));
+    size_t index;
+
+    // Without a Cpu the worker fails its own range and steals nothing, so
+    // the others still run everything they can.
+    if (!cpu) {
+        Range *range = &batch->ranges[worker->index];
+
+        perror("batch worker");
+        while (batch_claim(range, &index)) {
+            batch->jobs[index].failed = true;
+        }
+        return NULL;
+    }
+
+    // Own range first, then the others starting with the neighbour so
+    // thieves spread out instead of all hitting worker 0.
+    for (int i = 0; i < batch->workers; i++) {
+        Range *range = &batch->ranges[(worker->index + i) % batch->workers];
+
+        while (batch_claim(range, &index)) {
+            batch_runJob(batch, &batch->jobs[index], cpu);
+        }
+    }
+
+    free(cpu);
+
+    return NULL;
+}
+
+static int batch_defaultWorkers(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cores < 1) {
+        return 1;
+    }
+    return cores > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : (int) cores;
+}
+
+int main(int argc, char *argv[]) {
+    Batch batch = {
+        .workers = batch_defaultWorkers(),
+        .maxInstructions = BATCH_INSTRUCTIONS,
+        .maxCycles = CPU_RUN_UNLIMITED,
+    };
+    bool verbose = false;
+    int first = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            batch.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            batch.maxInstructions = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            batch.maxCycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            first = i;
+            break;
+        }
+    }
+
+    size_t count = argc - first;
+    if (count == 0) {
+        fprintf(stderr, "usage: %s [-j threads] [-n instructions] "
+                "[-c cycles] [-v] rom...\n", argv[0]);
+        return 1;
+    }
+    if (batch.workers < 1 || batch.workers > BATCH_MAX_THREADS) {
+        fprintf(stderr, "thread count must be between 1 and %d\n",
+                BATCH_MAX_THREADS);
+        return 1;
+    }
+    if ((size_t) batch.workers > count) {
+        batch.workers = count;
+    }
+
+    batch.jobs = calloc(count, sizeof(Job));
+    batch.ranges = calloc(batch.workers, sizeof(Range));
+    Worker *workers = calloc(batch.workers, sizeof(Worker));
+    if (!batch.jobs || !batch.ranges || !workers) {
+        perror("batch");
+        free(workers);
+        free(batch.ranges);
+        free(batch.jobs);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        batch.jobs[i].path = argv[first + i];
+    }
+    for (int i = 0; i < batch.workers; i++) {
+        atomic_init(&batch.ranges[i].next, count * i / batch.workers);
+        batch.ranges[i].end = count * (i + 1) / batch.workers;
+    }
+
+    double start = batch_now();
+
+    for (int i = 0; i < batch.workers; i++) {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, batch_work,
+                &workers[i]) != 0) {
+            perror("pthread_create");
+            // The workers already started use all three; they steal what
+            // the missing ones would have run, so wait for them.
+            for (int j = 0; j < i; j++) {
+                pthread_join(workers[j].thread, NULL);
+            }
+            free(workers);
+            free(batch.ranges);
+            free(batch.jobs);
+            return 1;
+        }
+    }
+    for (int i = 0; i < batch.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    double elapsed = batch_now() - start;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    size_t stops[CPU_STOP_ILLEGAL + 1] = { 0 };
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const Job *job = &batch.jobs[i];
+
+        if (job->failed) {
+            fprintf(stderr, "%s: could not run ROM\n", job->path);
+            failed++;
+            continue;
+        }
+
+        instructions += job->instructions;
+        cycles += job->cycles;
+        stops[job->stop]++;
+        if (verbose) {
+            printf("%s: %s after %llu instructions, %llu cycles, "
+                    "pc $%04x\n", job->path, batch_stopNames[job->stop],
+                    (unsigned long long) job->instructions,
+                    (unsigned long long) job->cycles, job->pc);
+        }
+    }
+
+    printf("roms: %zu (%zu failed)\n", count, failed);
+    printf("threads: %d\n", batch.workers);
+    for (int stop = CPU_STOP_INSTRUCTIONS; stop <= CPU_STOP_ILLEGAL;
+            stop++) {
+        if (stops[stop]) {
+            printf("stopped on %s: %zu\n", batch_stopNames[stop],
+                    stops[stop]);
+        }
+    }
+    printf("instructions: %llu\n", (unsigned long long) instructions);
+    printf("cycles: %llu\n", (unsigned long long) cycles);
+    printf("elapsed: %.3f s, %.1f M instructions/s\n", elapsed,
+            instructions / elapsed / 1e6);
+
+    free(workers);
+    free(batch.ranges);
+    free(batch.jobs);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * Interpreter throughput benchmark.
+ *
+ * The dispatch strategy is fixed at build time, so build once per
+ * strategy and run each binary against the same ROM:
+ *
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_SWITCH -o bench-switch \
+ *       bench.c cpu.c disasm.c
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_TABLE -o bench-table \
+ *       bench.c cpu.c disasm.c
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_THREADED -o bench-threaded \
+ *       bench.c cpu.c disasm.c
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_BLOCKS -o bench-blocks \
+ *       bench.c cpu.c disasm.c
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_JIT -o bench-jit \
+ *       bench.c cpu.c jit.c disasm.c
+ *
+ * The same goes for -DCPU_EAGER_FLAGS. Every run ends with a line describing
+ * the final machine state; two builds fed the same program must print
+ * the same line, which makes a quick differential check between eager
+ * and lazy flag evaluation.
+ *
+ * bench-jit -i keeps the JIT off and runs blocks only, so its state line
+ * checks the compiled code against the interpreter in the same binary.
+ * The blocks and JIT builds also count the instruction pairs that ran as
+ * one fused handler, and the instructions of idle loops (a branch back
+ * that only polls memory) that were skipped instead of run.
+ *
+ * Without a ROM argument one of the built-in kernels (-k) is used.
+ *
+ *   ./bench-threaded -f 6502_functional_test.bin [-a success]
+ *
+ * runs Klaus Dormann's functional test instead: the 64K image is loaded
+ * flat and started at $0400, and the run passes when it reaches the
+ * success trap ($3469 in the stock build; -a takes the address from
+ * another listing in hex). Landing in any other trap (an instruction
+ * that jumps or branches to itself) fails, naming the trap's address.
+ *
+ * Built with -DBENCH_RECOMPILED and the output of recompile in place of
+ * cpu.c, the ROM runs through its recompiled blocks instead; the ROM (or
+ * kernel) given has to be the one that was recompiled. The state line
+ * should match the interpreter's.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#ifdef BENCH_RECOMPILED
+#include "recompiled.h"
+#endif
+
+#define BENCH_INSTRUCTIONS 100000000
+#define BENCH_ROUNDS 5
+
+#define BENCH_FUNCTIONAL_START 0x0400
+#define BENCH_FUNCTIONAL_SUCCESS 0x3469
+// Far more than a passing run needs; a run that gets here has wandered off.
+#define BENCH_FUNCTIONAL_LIMIT 1000000000
+#define BENCH_FUNCTIONAL_SLICE 10000000
+
+static const byte bench_mixedKernel[] = {
+    0xa2, 0x00,         // LDX #$00
+    0xa9, 0x01,         // LDA #$01
+    0x18,               // CLC
+    0x69, 0x03,         // ADC #$03
+    0x85, 0x80,         // STA $80
+    0xe8,               // INX
+    0x95, 0x80,         // STA $80,X
+    0xa5, 0x80,         // LDA $80
+    0x29, 0x0f,         // AND #$0f
+    0x0a,               // ASL A
+    0xaa,               // TAX
+    0xc9, 0x10,         // CMP #$10
+    0xa8,               // TAY
+    0xc8,               // INY
+    0x8d, 0x00, 0x01,   // STA $0100
+    0x4c, 0x00, 0x10    // JMP $1000
+};
+
+// Flag-heavy: every ADC/SBC result is overwritten before anything but the
+// next carry-in looks at its flags.
+static const byte bench_arithKernel[] = {
+    0x18,               // CLC
+    0xa9, 0x10,         // LDA #$10
+    0x69, 0x22,         // ADC #$22
+    0x65, 0x80,         // ADC $80
+    0xe9, 0x05,         // SBC #$05
+    0x85, 0x81,         // STA $81
+    0x65, 0x81,         // ADC $81
+    0xe5, 0x80,         // SBC $80
+    0x69, 0x7f,         // ADC #$7f
+    0xe9, 0x01,         // SBC #$01
+    0x85, 0x80,         // STA $80
+    0x69, 0x03,         // ADC #$03
+    0xe9, 0x02,         // SBC #$02
+    0x4c, 0x00, 0x10    // JMP $1000
+};
+
+// A wait that never ends, polling a byte like a timer or sync wait would;
+// the blocks and JIT builds count its iterations instead of running them.
+static const byte bench_idleKernel[] = {
+    0xa9, 0x00,         // LDA #$00
+    0x85, 0x80,         // STA $80
+    0x24, 0x80,         // BIT $80
+    0x10, 0xfc          // BPL $1004
+};
+
+typedef struct _kernel {
+    const char *name;
+    const byte *code;
+    size_t size;
+} Kernel;
+
+static const Kernel bench_kernels[] = {
+    { "mixed", bench_mixedKernel, sizeof(bench_mixedKernel) },
+    { "arith", bench_arithKernel, sizeof(bench_arithKernel) },
+    { "idle", bench_idleKernel, sizeof(bench_idleKernel) },
+};
+
+static const char *bench_dispatchName(void) {
+#ifdef BENCH_RECOMPILED
+    return "recompiled";
+#endif
+    switch (CPU_DISPATCH) {
+        case CPU_DISPATCH_SWITCH:
+            return "switch";
+        case CPU_DISPATCH_TABLE:
+            return "table";
+        case CPU_DISPATCH_THREADED:
+            return "threaded";
+        case CPU_DISPATCH_BLOCKS:
+            return "blocks";
+        case CPU_DISPATCH_JIT:
+            return "jit";
+    }
+    return "unknown";
+}
+
+static const char *bench_flagsName(void) {
+#ifdef CPU_LAZY_FLAGS
+    return "lazy";
+#else
+    return "eager";
+#endif
+}
+
+static uint32_t bench_memoryHash(Cpu *cpu) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < MAX_MEMORY; i++) {
+        hash = (hash ^ cpu_read(cpu, i)) * 16777619u;
+    }
+
+    return hash;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long bench_readRom(const char *path, byte *buffer) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    size_t sz = fread(buffer, 1, ROM_END - ROM_START + 1, f);
+    fclose(f);
+    if (sz == 0) {
+        fprintf(stderr, "%s: empty ROM\n", path);
+        return -1;
+    }
+
+    return sz;
+}
+
+// A trap is an instruction that only goes back to itself, a JMP to its
+// own address or a taken branch with offset -2. Stepping it tells.
+static bool bench_isTrap(Cpu *cpu, uint64_t *instructions) {
+    uint16_t pc = cpu->pc;
+
+    cpu_step(cpu);
+    (*instructions)++;
+    return cpu->pc == pc;
+}
+
+// Runs the functional test until it traps or hits an illegal opcode, in
+// slices so a failure trap is noticed; the success trap is a breakpoint so
+// a passing run stops right on it. Returns whether it passed.
+static bool bench_functionalRun(Cpu *cpu, const byte *image, long size,
+        uint16_t success, uint64_t *instructions) {
+    CpuStopReason stop = CPU_STOP_NONE;
+
+    cpu_initialize(cpu);
+    cpu_mapFlat(cpu);
+    memcpy(cpu->memory, image, size);
+    cpu_flushBlocks(cpu);
+    cpu->pc = BENCH_FUNCTIONAL_START;
+    cpu_setBreakpoint(cpu, success, true);
+
+    *instructions = 0;
+    while (*instructions < BENCH_FUNCTIONAL_LIMIT) {
+        *instructions += cpu_run(cpu, BENCH_FUNCTIONAL_SLICE,
+                CPU_RUN_UNLIMITED, &stop);
+        if (stop == CPU_STOP_BREAKPOINT || stop == CPU_STOP_ILLEGAL
+                || (stop == CPU_STOP_INSTRUCTIONS
+                    && bench_isTrap(cpu, instructions))) {
+            break;
+        }
+    }
+
+    cpu_release(cpu);
+    // A slice can also run out just as it reaches the success trap.
+    return stop == CPU_STOP_BREAKPOINT || cpu->pc == success;
+}
+
+static int bench_functional(const char *path, uint16_t success) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    byte *image = calloc(MAX_MEMORY, sizeof(byte));
+    long size = fread(image, 1, MAX_MEMORY, f);
+    fclose(f);
+    if (size <= BENCH_FUNCTIONAL_START) {
+        fprintf(stderr, "%s: too short for a functional test image\n", path);
+        free(image);
+        return 1;
+    }
+
+    Cpu *cpu = malloc(sizeof(Cpu));
+    uint64_t instructions = 0;
+    double best = 0;
+    bool passed = true;
+
+    for (int round = 0; round < BENCH_ROUNDS && passed; round++) {
+        double start = bench_now();
+        passed = bench_functionalRun(cpu, image, size, success,
+                &instructions);
+        double elapsed = bench_now() - start;
+
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("dispatch: %s\n", bench_dispatchName());
+    printf("flags: %s\n", bench_flagsName());
+    printf("rom: %s\n", path);
+    if (passed) {
+        printf("functional: passed at $%04x\n", cpu->pc);
+    } else {
+        printf("functional: FAILED, trapped at $%04x (A=%02x X=%02x Y=%02x "
+                "P=%02x SP=%04x)\n", cpu->pc, cpu->acc, cpu->x, cpu->y,
+                cpu_getStatus(cpu), cpu->sp);
+    }
+    printf("instructions: %llu\n", (unsigned long long) instructions);
+    printf("cycles: %llu\n", (unsigned long long) cpu->cycles);
+    printf("best of %d: %.3f s, %.1f M instructions/s, %.1f M cycles/s\n",
+            passed ? BENCH_ROUNDS : 1, best, instructions / best / 1e6,
+            cpu->cycles / best / 1e6);
+
+    free(cpu);
+    free(image);
+
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    long instructions = BENCH_INSTRUCTIONS;
+    const char *rom = NULL;
+    const Kernel *kernel = &bench_kernels[0];
+    const char *functional = NULL;
+    uint16_t success = BENCH_FUNCTIONAL_SUCCESS;
+    bool jit = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            instructions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            functional = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            jit = false;
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            success = strtoul(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            size_t count = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+
+            kernel = NULL;
+            for (size_t k = 0; k < count; k++) {
+                if (strcmp(bench_kernels[k].name, name) == 0) {
+                    kernel = &bench_kernels[k];
+                }
+            }
+            if (!kernel) {
+                fprintf(stderr, "unknown kernel: %s\n", name);
+                return 1;
+            }
+        } else {
+            rom = argv[i];
+        }
+    }
+
+    if (functional) {
+        return bench_functional(functional, success);
+    }
+
+    byte *buffer = calloc(ROM_END - ROM_START + 1, sizeof(byte));
+    long size = kernel->size;
+    if (rom) {
+        size = bench_readRom(rom, buffer);
+        if (size < 0) {
+            return 1;
+        }
+    } else {
+        memcpy(buffer, kernel->code, size);
+    }
+
+    Cpu *cpu = malloc(sizeof(Cpu));
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        cpu_initialize(cpu);
+        cpu_setJit(cpu, jit);
+        cpu_loadRom(cpu, buffer, size);
+#ifdef BENCH_RECOMPILED
+        if (!recompiled_attach(&recompiled_program, cpu)) {
+            fprintf(stderr, "%s: not the ROM that was recompiled\n",
+                    rom ? rom : kernel->name);
+            return 1;
+        }
+#endif
+
+        double start = bench_now();
+#ifdef BENCH_RECOMPILED
+        recompiled_run(cpu, &recompiled_program, instructions, NULL);
+#else
+        cpu_run(cpu, instructions, CPU_RUN_UNLIMITED, NULL);
+#endif
+        double elapsed = bench_now() - start;
+
+        cpu_release(cpu);
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("dispatch: %s\n", bench_dispatchName());
+    printf("flags: %s\n", bench_flagsName());
+    printf("rom: %s\n", rom ? rom : kernel->name);
+    printf("instructions: %ld\n", instructions);
+    printf("state: A=%02x X=%02x Y=%02x P=%02x SP=%04x PC=%04x "
+            "cycles=%llu memory=%08x\n", cpu->acc, cpu->x, cpu->y,
+            cpu_getStatus(cpu), cpu->sp, cpu->pc,
+            (unsigned long long) cpu->cycles, bench_memoryHash(cpu));
+#ifdef CPU_BLOCK_CACHE
+    printf("fused: %llu pairs\n", (unsigned long long) cpu->fusedOps);
+    printf("idle: %llu instructions skipped\n",
+            (unsigned long long) cpu->idleInstructions);
+#endif
+    printf("best of %d: %.3f s, %.1f M instructions/s\n", BENCH_ROUNDS,
+            best, instructions / best / 1e6);
+
+    free(cpu);
+    free(buffer);
+
+    return 0;
+}
@@ -0,0 +1,498 @@
+/*
+ * Runs single-step test vectors against the core: one JSON file per
+ * opcode, named after it in hex (a9.json), holding an array of tests that
+ * each give the registers and memory before and after one instruction and
+ * the bus cycles it took. This is the layout of the SingleStepTests 65x02
+ * suite (6502/v1).
+ *
+ *   cc -O2 -o conformance conformance.c cpu.c disasm.c
+ *   ./conformance [-v] [-o opcode] directory
+ *
+ * Every documented opcode is run, or just the one given with -o. Each gets
+ * a line with its failures broken down by field, and -v adds the first
+ * failing test for every field. The core doesn't model individual bus
+ * accesses, so cycles are compared by count. B and bit 5 of P aren't
+ * compared either, since they only exist on the stack.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "disasm.h"
+
+#define CONFORMANCE_MAX_RAM 64
+
+typedef struct _vectorState {
+    uint16_t pc;
+    uint8_t s;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    int ramCount;
+    uint16_t ramAddress[CONFORMANCE_MAX_RAM];
+    uint8_t ramValue[CONFORMANCE_MAX_RAM];
+} VectorState;
+
+typedef struct _vector {
+    const char *name;
+    int nameLength;
+    VectorState initial;
+    VectorState final;
+    int cycles;
+} Vector;
+
+typedef enum _field {
+    FIELD_PC,
+    FIELD_S,
+    FIELD_A,
+    FIELD_X,
+    FIELD_Y,
+    FIELD_P,
+    FIELD_RAM,
+    FIELD_CYCLES,
+    FIELD_COUNT
+} Field;
+
+static const char *const conformance_fieldNames[FIELD_COUNT] = {
+    "pc", "s", "a", "x", "y", "p", "ram", "cycles"
+};
+
+// Just enough JSON for the vector files: objects, arrays, unsigned
+// integers and strings, with anything unexpected skipped over.
+typedef struct _parser {
+    const char *p;
+    const char *end;
+    bool failed;
+} Parser;
+
+static double conformance_now(void);
+static void conformance_space(Parser *parser);
+static bool conformance_accept(Parser *parser, char c);
+static void conformance_expect(Parser *parser, char c);
+static unsigned long conformance_number(Parser *parser);
+static const char *conformance_string(Parser *parser, int *length);
+static void conformance_skip(Parser *parser);
+static bool conformance_key(const char *name, int length, const char *key);
+static void conformance_state(Parser *parser, VectorState *state);
+static void conformance_cycles(Parser *parser, int *cycles);
+static bool conformance_vector(Parser *parser, Vector *vector);
+static unsigned conformance_run(Cpu *cpu, const Vector *vector,
+        uint16_t *failedAddress);
+static void conformance_report(const Cpu *cpu, const Vector *vector,
+        Field field, uint16_t failedAddress);
+static int conformance_file(Cpu *cpu, const char *path, uint8_t opcode,
+        bool verbose, long *tests, long *failures);
+
+static double conformance_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void conformance_space(Parser *parser) {
+    while (parser->p < parser->end && (*parser->p == ' '
+                || *parser->p == '\n' || *parser->p == '\r'
+                || *parser->p == '\t')) {
+        parser->p++;
+    }
+}
+
+static bool conformance_accept(Parser *parser, char c) {
+    conformance_space(parser);
+    if (parser->p < parser->end && *parser->p == c) {
+        parser->p++;
+        return true;
+    }
+    return false;
+}
+
+static void conformance_expect(Parser *parser, char c) {
+    if (!conformance_accept(parser, c)) {
+        parser->failed = true;
+    }
+}
+
+static unsigned long conformance_number(Parser *parser) {
+    unsigned long value = 0;
+
+    conformance_space(parser);
+    if (parser->p >= parser->end || *parser->p < '0' || *parser->p > '9') {
+        parser->failed = true;
+        return 0;
+    }
+    while (parser->p < parser->end && *parser->p >= '0' && *parser->p <= '9') {
+        value = value * 10 + (*parser->p++ - '0');
+    }
+    return value;
+}
+
+static const char *conformance_string(Parser *parser, int *length) {
+    const char *start;
+
+    if (!conformance_accept(parser, '"')) {
+        parser->failed = true;
+        return NULL;
+    }
+    start = parser->p;
+    while (parser->p < parser->end && *parser->p != '"') {
+        if (*parser->p == '\\') {
+            parser->p++;
+        }
+        parser->p++;
+    }
+    *length = parser->p - start;
+    conformance_expect(parser, '"');
+    return start;
+}
+
+static void conformance_skip(Parser *parser) {
+    int length;
+
+    conformance_space(parser);
+    if (parser->p >= parser->end) {
+        parser->failed = true;
+    } else if (*parser->p == '"') {
+        conformance_string(parser, &length);
+    } else if (conformance_accept(parser, '[')) {
+        if (!conformance_accept(parser, ']')) {
+            do {
+                conformance_skip(parser);
+            } while (!parser->failed && conformance_accept(parser, ','));
+            conformance_expect(parser, ']');
+        }
+    } else if (conformance_accept(parser, '{')) {
+        if (!conformance_accept(parser, '}')) {
+            do {
+                conformance_string(parser, &length);
+                conformance_expect(parser, ':');
+                conformance_skip(parser);
+            } while (!parser->failed && conformance_accept(parser, ','));
+            conformance_expect(parser, '}');
+        }
+    } else {
+        // Numbers, true, false and null.
+        while (parser->p < parser->end && *parser->p != ','
+                && *parser->p != ']' && *parser->p != '}') {
+            parser->p++;
+        }
+    }
+}
+
+static bool conformance_key(const char *name, int length, const char *key) {
+    return (int) strlen(key) == length && memcmp(name, key, length) == 0;
+}
+
+static void conformance_state(Parser *parser, VectorState *state) {
+    const char *name;
+    int length;
+
+    state->ramCount = 0;
+    conformance_expect(parser, '{');
+    do {
+        name = conformance_string(parser, &length);
+        conformance_expect(parser, ':');
+        if (parser->failed) {
+            return;
+        }
+
+        if (conformance_key(name, length, "pc")) {
+            state->pc = conformance_number(parser);
+        } else if (conformance_key(name, length, "s")) {
+            state->s = conformance_number(parser);
+        } else if (conformance_key(name, length, "a")) {
+            state->a = conformance_number(parser);
+        } else if (conformance_key(name, length, "x")) {
+            state->x = conformance_number(parser);
+        } else if (conformance_key(name, length, "y")) {
+            state->y = conformance_number(parser);
+        } else if (conformance_key(name, length, "p")) {
+            state->p = conformance_number(parser);
+        } else if (conformance_key(name, length, "ram")) {
+            conformance_expect(parser, '[');
+            if (conformance_accept(parser, ']')) {
+                continue;
+            }
+            do {
+                if (state->ramCount == CONFORMANCE_MAX_RAM) {
+                    parser->failed = true;
+                    return;
+                }
+                conformance_expect(parser, '[');
+                state->ramAddress[state->ramCount] =
+                    conformance_number(parser);
+                conformance_expect(parser, ',');
+                state->ramValue[state->ramCount] = conformance_number(parser);
+                conformance_expect(parser, ']');
+                state->ramCount++;
+            } while (!parser->failed && conformance_accept(parser, ','));
+            conformance_expect(parser, ']');
+        } else {
+            conformance_skip(parser);
+        }
+    } while (!parser->failed && conformance_accept(parser, ','));
+    conformance_expect(parser, '}');
+}
+
+static void conformance_cycles(Parser *parser, int *cycles) {
+    *cycles = 0;
+    conformance_expect(parser, '[');
+    if (conformance_accept(parser, ']')) {
+        return;
+    }
+    do {
+        conformance_skip(parser);
+        (*cycles)++;
+    } while (!parser->failed && conformance_accept(parser, ','));
+    conformance_expect(parser, ']');
+}
+
+// Reads the next test of the array. Returns false at its end or on
+// malformed input, which leaves parser->failed set.
+static bool conformance_vector(Parser *parser, Vector *vector) {
+    const char *name;
+    int length;
+
+    if (!conformance_accept(parser, '{')) {
+        return false;
+    }
+    vector->name = "";
+    vector->nameLength = 0;
+    vector->cycles = -1;
+    do {
+        name = conformance_string(parser, &length);
+        conformance_expect(parser, ':');
+        if (parser->failed) {
+            return false;
+        }
+
+        if (conformance_key(name, length, "name")) {
+            vector->name = conformance_string(parser, &vector->nameLength);
+        } else if (conformance_key(name, length, "initial")) {
+            conformance_state(parser, &vector->initial);
+        } else if (conformance_key(name, length, "final")) {
+            conformance_state(parser, &vector->final);
+        } else if (conformance_key(name, length, "cycles")) {
+            conformance_cycles(parser, &vector->cycles);
+        } else {
+            conformance_skip(parser);
+        }
+    } while (!parser->failed && conformance_accept(parser, ','));
+    conformance_expect(parser, '}');
+    conformance_accept(parser, ',');
+
+    return !parser->failed;
+}
+
+// Steps one vector and returns a bit per mismatched Field.
+static unsigned conformance_run(Cpu *cpu, const Vector *vector,
+        uint16_t *failedAddress) {
+    const VectorState *initial = &vector->initial;
+    const VectorState *final = &vector->final;
+    unsigned failed = 0;
+
+    for (int i = 0; i < initial->ramCount; i++) {
+        cpu->memory[initial->ramAddress[i]] = initial->ramValue[i];
+    }
+    cpu->pc = initial->pc;
+    cpu->sp = STACK_END | initial->s;
+    cpu->acc = initial->a;
+    cpu->x = initial->x;
+    cpu->y = initial->y;
+    cpu_setStatus(cpu, initial->p);
+    cpu->cycles = 0;
+
+    cpu_step(cpu);
+
+    if (cpu->pc != final->pc) {
+        failed |= 1 << FIELD_PC;
+    }
+    if (cpu->sp != (STACK_END | final->s)) {
+        failed |= 1 << FIELD_S;
+    }
+    if (cpu->acc != final->a) {
+        failed |= 1 << FIELD_A;
+    }
+    if (cpu->x != final->x) {
+        failed |= 1 << FIELD_X;
+    }
+    if (cpu->y != final->y) {
+        failed |= 1 << FIELD_Y;
+    }
+    if ((cpu_getStatus(cpu) ^ final->p) & ~(FLAG_BREAK | FLAG_UNUSED)) {
+        failed |= 1 << FIELD_P;
+    }
+    for (int i = 0; i < final->ramCount; i++) {
+        if (cpu->memory[final->ramAddress[i]] != final->ramValue[i]) {
+            *failedAddress = final->ramAddress[i];
+            failed |= 1 << FIELD_RAM;
+            break;
+        }
+    }
+    if (vector->cycles >= 0 && cpu->cycles != (uint64_t) vector->cycles) {
+        failed |= 1 << FIELD_CYCLES;
+    }
+
+    return failed;
+}
+
+static void conformance_report(const Cpu *cpu, const Vector *vector,
+        Field field, uint16_t failedAddress) {
+    const VectorState *final = &vector->final;
+    unsigned expected = 0;
+    unsigned got = 0;
+
+    switch (field) {
+        case FIELD_PC: expected = final->pc; got = cpu->pc; break;
+        case FIELD_S: expected = final->s; got = cpu->sp & 0xff; break;
+        case FIELD_A: expected = final->a; got = cpu->acc; break;
+        case FIELD_X: expected = final->x; got = cpu->x; break;
+        case FIELD_Y: expected = final->y; got = cpu->y; break;
+        case FIELD_P:
+            expected = final->p & ~(FLAG_BREAK | FLAG_UNUSED);
+            got = cpu_getStatus(cpu) & ~(FLAG_BREAK | FLAG_UNUSED);
+            break;
+        case FIELD_RAM:
+            for (int i = 0; i < final->ramCount; i++) {
+                if (final->ramAddress[i] == failedAddress) {
+                    expected = final->ramValue[i];
+                }
+            }
+            got = cpu->memory[failedAddress];
+            printf("    \"%.*s\": ram $%04x expected $%02x, got $%02x\n",
+                    vector->nameLength, vector->name, failedAddress,
+                    expected, got);
+            return;
+        case FIELD_CYCLES:
+            expected = vector->cycles;
+            got = cpu->cycles;
+            break;
+        default:
+            break;
+    }
+    printf("    \"%.*s\": %s expected $%02x, got $%02x\n", vector->nameLength,
+            vector->name, conformance_fieldNames[field], expected, got);
+}
+
+// Runs every vector in one file. Returns -1 if it can't be read or
+// parsed, after saying why.
+static int conformance_file(Cpu *cpu, const char *path, uint8_t opcode,
+        bool verbose, long *tests, long *failures) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buffer = malloc(sz > 0 ? sz : 1);
+    if (fread(buffer, 1, sz, f) != (size_t) sz) {
+        perror(path);
+        fclose(f);
+        free(buffer);
+        return -1;
+    }
+    fclose(f);
+
+    Parser parser = { buffer, buffer + sz, false };
+    static Vector vector;
+    long fieldFailures[FIELD_COUNT] = { 0 };
+    long count = 0;
+    long failed = 0;
+
+    conformance_expect(&parser, '[');
+    while (conformance_vector(&parser, &vector)) {
+        uint16_t failedAddress = 0;
+        unsigned mismatches = conformance_run(cpu, &vector, &failedAddress);
+
+        count++;
+        if (!mismatches) {
+            continue;
+        }
+        failed++;
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            if (!(mismatches & (1 << field))) {
+                continue;
+            }
+            if (verbose && fieldFailures[field] == 0) {
+                conformance_report(cpu, &vector, field, failedAddress);
+            }
+            fieldFailures[field]++;
+        }
+    }
+    conformance_expect(&parser, ']');
+    free(buffer);
+
+    if (parser.failed) {
+        fprintf(stderr, "%s: malformed after %ld tests\n", path, count);
+        return -1;
+    }
+
+    const OpcodeInfo *info = &disasm_opcodes[opcode];
+    printf("%02x %s: %ld tests, %ld failed", opcode, info->mnemonic, count,
+            failed);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (fieldFailures[field]) {
+            printf(" %s=%ld", conformance_fieldNames[field],
+                    fieldFailures[field]);
+        }
+    }
+    printf("\n");
+
+    *tests += count;
+    *failures += failed;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static Cpu cpu;
+    bool verbose = false;
+    int only = -1;
+    const char *directory = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            only = strtoul(argv[++i], NULL, 16) & 0xff;
+        } else {
+            directory = argv[i];
+        }
+    }
+    if (!directory) {
+        fprintf(stderr, "usage: %s [-v] [-o opcode] directory\n", argv[0]);
+        return 1;
+    }
+
+    cpu_initialize(&cpu);
+    cpu_mapFlat(&cpu);
+
+    double start = conformance_now();
+    long tests = 0;
+    long failures = 0;
+    int missing = 0;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+        char path[4096];
+
+        if (!disasm_opcodes[opcode].mnemonic
+                || (only >= 0 && opcode != only)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%02x.json", directory, opcode);
+        if (conformance_file(&cpu, path, opcode, verbose, &tests,
+                    &failures) < 0) {
+            missing++;
+        }
+    }
+
+    double elapsed = conformance_now() - start;
+    printf("%ld tests, %ld failed, %d files unreadable, %.2f s\n", tests,
+            failures, missing, elapsed);
+
+    return failures || missing ? 1 : 0;
+}
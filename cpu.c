@@ -3,6 +3,14 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "disasm.h"
+#include "jit.h"
+#include "opcodes.h"
+
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED && !defined(__GNUC__)
+#undef CPU_DISPATCH
+#define CPU_DISPATCH CPU_DISPATCH_SWITCH
+#endif
 
 #define WORD_MAX 127
 #define WORD_MIN -128
@@ -10,59 +18,327 @@
 #define MASK_CARRY(x) ((x & 0x100) >> 8)
 #define MASK_SIGN(x) ((x & 0x80) >> 7)
 
-#define STATE_SIGN MASK_SIGN
-#define STATE_OVERFLOW(x) ((x & 0x40) >> 6)
-#define STATE_BREAKPOINT(x) ((x & 0x10) >> 4)
-#define STATE_DECIMAL(x) ((x & 0x08) >> 3)
-#define STATE_INTERRUPT(x) ((x & 0x04) >> 2)
-#define STATE_ZERO(x) ((x & 0x02) >> 1)
-#define STATE_CARRY(x) (x & 0x01)
-
 #define MASK_BIT0(x) (x & 0x01)
 
+#define CPU_SIGN(cpu) ((cpu)->flagN >> 7)
+#define CPU_ZERO(cpu) ((cpu)->flagZ == 0)
+
+// With CPU_LAZY_FLAGS, arithmetic only records what it computed; C and V
+// are decoded here when a branch, a carry-in or P needs them. V is set
+// when the result's sign differs from the sign of both inputs.
+#ifdef CPU_LAZY_FLAGS
+#define CPU_CARRY(cpu) ((cpu)->flagC > 0xff)
+#define CPU_OVERFLOW(cpu) \
+    (MASK_SIGN((cpu)->flagVAcc & (cpu)->flagVOperand))
+#else
+#define CPU_CARRY(cpu) ((cpu)->p & FLAG_CARRY)
+#define CPU_OVERFLOW(cpu) (((cpu)->p & FLAG_OVERFLOW) != 0)
+#endif
+
+#ifdef CPU_BLOCK_CACHE
+// Everything an instruction can change besides pc, cycles and memory.
+typedef struct _cpuRegisters {
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t flagN;
+    uint8_t flagZ;
+    uint16_t flagC;
+    uint8_t flagVAcc;
+    uint8_t flagVOperand;
+    uint16_t sp;
+} CpuRegisters;
+#endif
+
 static void cpu_setArithmeticFlags(Cpu *cpu, uint16_t result, 
-        uint8_t op1);
-static void cpu_setZNFlags(Cpu *cpu, uint16_t result);
-static uint16_t cpu_fetchIIAX(Cpu *cpu, byte *buffer);
-static uint16_t cpu_fetchIIAY(Cpu *cpu, byte *buffer);
+        uint8_t acc, uint8_t operand);
+static inline void cpu_setZNFlags(Cpu *cpu, uint8_t result);
+static inline void cpu_setFlag(Cpu *cpu, uint8_t flag, bool set);
+static inline void cpu_setCarry(Cpu *cpu, bool set);
+static inline void cpu_setOverflow(Cpu *cpu, bool set);
+static void cpu_buildDecimalTables(void);
+static inline void cpu_setDecimalResult(Cpu *cpu, uint16_t entry);
+static inline void cpu_add(Cpu *cpu, uint8_t value);
+static inline void cpu_subtract(Cpu *cpu, uint8_t value);
+static inline void cpu_compare(Cpu *cpu, uint8_t reg, uint8_t value);
+static inline void cpu_bit(Cpu *cpu, uint8_t value);
+static inline void cpu_push(Cpu *cpu, uint8_t value);
+static inline uint8_t cpu_pull(Cpu *cpu);
+static inline uint8_t cpu_fetch(Cpu *cpu, uint16_t offset);
+static uint16_t cpu_fetchIIAX(Cpu *cpu);
+static uint16_t cpu_fetchIIAY(Cpu *cpu, bool read);
+static uint16_t cpu_fetchAbsIndexed(Cpu *cpu, uint8_t index, 
+        bool read);
+static uint8_t cpu_pageCrossed(uint16_t from, uint16_t to);
+static void cpu_branch(Cpu *cpu, bool taken);
 static uint8_t cpu_lowerByte(uint16_t dword);
 static uint8_t cpu_higherByte(uint16_t dword);
 static uint16_t cpu_toDWORD(uint8_t higher, uint8_t lower);
-static void cpu_setStateBit(Cpu *cpu, int bit);
-static void cpu_clearStateBit(Cpu *cpu, int bit);
-static uint8_t cpu_stateToWord(Cpu *cpu);
-static void cpu_wordToState(Cpu *cpu, uint8_t word);
-
+static inline bool cpu_isBreakpoint(const Cpu *cpu, uint16_t address);
+#ifdef CPU_PROFILE
+static inline void cpu_profileBegin(Cpu *cpu, uint8_t opcode);
+static inline void cpu_profileEnd(Cpu *cpu, uint8_t opcode);
+static int cpu_profileTop(const uint64_t *counts, size_t size, int top,
+        int *indices);
+#endif
+static void cpu_invalidateSnapshot(Cpu *cpu);
+static void cpu_mapped(Cpu *cpu);
+static void cpu_trapWrite(Cpu *cpu, uint16_t address, uint8_t value,
+        void *context);
+#ifdef CPU_BLOCK_CACHE
+static bool cpu_endsBlock(uint8_t opcode);
+static void cpu_buildBlock(Cpu *cpu, CpuBlock *block, uint16_t start);
+static void cpu_watchBlock(Cpu *cpu, const CpuBlock *block);
+#ifndef CPU_PROFILE
+static void (*cpu_fusedHandler(uint8_t first, uint8_t second))(Cpu *cpu);
+static void cpu_fuseBlock(CpuBlock *block);
+static bool cpu_onlyReads(const Cpu *cpu, uint8_t opcode, uint16_t operand);
+static bool cpu_isIdleLoop(Cpu *cpu, const CpuBlock *block);
+#endif
+static inline CpuBlock *cpu_findBlock(Cpu *cpu);
+static inline uint8_t cpu_runBlock(Cpu *cpu, const CpuBlock *block);
+static void cpu_saveRegisters(const Cpu *cpu, CpuRegisters *registers);
+static bool cpu_sameRegisters(const Cpu *cpu, const CpuRegisters *registers);
+static uint64_t cpu_runIdle(Cpu *cpu, const CpuBlock *block,
+        uint64_t instructionsLeft, uint64_t cycleLimit, bool breakpoints);
+static void cpu_dropBlocks(Cpu *cpu, const uint8_t *data);
+#endif
+
+// Wrapped around every instruction the dispatchers execute.
+#ifdef CPU_PROFILE
+#define CPU_PROFILE_BEGIN(cpu, opcode) cpu_profileBegin(cpu, opcode);
+#define CPU_PROFILE_END(cpu, opcode) cpu_profileEnd(cpu, opcode);
+#else
+#define CPU_PROFILE_BEGIN(cpu, opcode)
+#define CPU_PROFILE_END(cpu, opcode)
+#endif
+
+// Base cycle counts. Page-crossing and branch-taken penalties are added by
+// the addressing helpers.
+#define CPU_CYCLES(op, name, mnemonic, mode, cycles) [op] = cycles,
+static const uint8_t cpu_cycleTable[256] = {
+    CPU_OPCODES(CPU_CYCLES)
+};
+#undef CPU_CYCLES
+
+// result is the 9-bit sum of acc, operand and the carry in.
 static void cpu_setArithmeticFlags(Cpu *cpu, uint16_t result, 
-        uint8_t op1) {
-    cpu->s.sign = MASK_SIGN(result);
-    cpu->s.overflow = (MASK_SIGN(result) == MASK_SIGN(op1)) ? 1 : 0;
-    cpu->s.zero = (result & 0xff) == 0 ? 1 : 0;
-    cpu->s.carry = (result > WORD_MAX || result < WORD_MIN); 
+        uint8_t acc, uint8_t operand) {
+    cpu_setZNFlags(cpu, result);
+#ifdef CPU_LAZY_FLAGS
+    cpu->flagC = result;
+    cpu->flagVAcc = acc ^ result;
+    cpu->flagVOperand = operand ^ result;
+#else
+    cpu_setOverflow(cpu, MASK_SIGN((acc ^ result) & (operand ^ result)));
+    cpu_setCarry(cpu, result > 0xff);
+#endif
+}
+
+static inline void cpu_setZNFlags(Cpu *cpu, uint8_t result) {
+    cpu->flagN = result;
+    cpu->flagZ = result;
+}
+
+static inline void cpu_setFlag(Cpu *cpu, uint8_t flag, bool set) {
+    cpu->p = (cpu->p & ~flag) | (set ? flag : 0);
+}
+
+static inline void cpu_setCarry(Cpu *cpu, bool set) {
+#ifdef CPU_LAZY_FLAGS
+    cpu->flagC = set ? 0x100 : 0;
+#else
+    cpu_setFlag(cpu, FLAG_CARRY, set);
+#endif
+}
+
+static inline void cpu_setOverflow(Cpu *cpu, bool set) {
+#ifdef CPU_LAZY_FLAGS
+    cpu->flagVAcc = set ? 0x80 : 0;
+    cpu->flagVOperand = 0x80;
+#else
+    cpu_setFlag(cpu, FLAG_OVERFLOW, set);
+#endif
+}
+
+// Decimal mode ADC and SBC, precomputed so they cost a lookup, indexed by
+// carry in and then by A << 8 | operand. An entry has the accumulator in
+// its low byte and N, V, Z and C at their FLAG_* bits in the high byte.
+static uint16_t cpu_decimalAdd[2][0x10000];
+static uint16_t cpu_decimalSubtract[2][0x10000];
+
+// Follows the NMOS part rather than BCD: invalid digits are adjusted the
+// same way valid ones are, N and V come from the sum before the high digit
+// is adjusted, and Z from the binary sum. SBC sets every flag as it does
+// in binary mode; only the accumulator is adjusted.
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void cpu_buildDecimalTables(void) {
+    for (int carry = 0; carry < 2; carry++) {
+        for (int a = 0; a < 0x100; a++) {
+            for (int b = 0; b < 0x100; b++) {
+                int low = (a & 0x0f) + (b & 0x0f) + carry;
+                if (low >= 0x0a) {
+                    low = ((low + 0x06) & 0x0f) + 0x10;
+                }
+                int sum = (a & 0xf0) + (b & 0xf0) + low;
+                int signedSum = (int8_t) (a & 0xf0) + (int8_t) (b & 0xf0)
+                    + low;
+                uint8_t flags = sum & FLAG_SIGN;
+                if (signedSum < WORD_MIN || signedSum > WORD_MAX) {
+                    flags |= FLAG_OVERFLOW;
+                }
+                if (((a + b + carry) & 0xff) == 0) {
+                    flags |= FLAG_ZERO;
+                }
+                if (sum >= 0xa0) {
+                    sum += 0x60;
+                }
+                if (sum >= 0x100) {
+                    flags |= FLAG_CARRY;
+                }
+                cpu_decimalAdd[carry][a << 8 | b] = flags << 8 | (sum & 0xff);
+
+                int difference = a - b - !carry;
+                low = (a & 0x0f) - (b & 0x0f) - !carry;
+                if (low < 0) {
+                    low = ((low - 0x06) & 0x0f) - 0x10;
+                }
+                int adjusted = (a & 0xf0) - (b & 0xf0) + low;
+                if (adjusted < 0) {
+                    adjusted -= 0x60;
+                }
+                flags = difference & FLAG_SIGN;
+                if (((a ^ b) & (a ^ difference)) & 0x80) {
+                    flags |= FLAG_OVERFLOW;
+                }
+                if ((difference & 0xff) == 0) {
+                    flags |= FLAG_ZERO;
+                }
+                if (difference >= 0) {
+                    flags |= FLAG_CARRY;
+                }
+                cpu_decimalSubtract[carry][a << 8 | b] =
+                    flags << 8 | (adjusted & 0xff);
+            }
+        }
+    }
+}
+
+static inline void cpu_setDecimalResult(Cpu *cpu, uint16_t entry) {
+    uint8_t flags = entry >> 8;
+    cpu->acc = entry;
+    cpu->flagN = flags;
+    cpu->flagZ = ~flags & FLAG_ZERO;
+    cpu_setCarry(cpu, flags & FLAG_CARRY);
+    cpu_setOverflow(cpu, flags & FLAG_OVERFLOW);
+}
+
+static inline void cpu_add(Cpu *cpu, uint8_t value) {
+    if (cpu->p & FLAG_DECIMAL) {
+        cpu_setDecimalResult(cpu,
+                cpu_decimalAdd[CPU_CARRY(cpu)][cpu->acc << 8 | value]);
+        return;
+    }
+    uint16_t result = (uint16_t) cpu->acc + value + CPU_CARRY(cpu);
+    cpu_setArithmeticFlags(cpu, result, cpu->acc, value);
+    cpu->acc = result;
 }
 
-static void cpu_setZNFlags(Cpu *cpu, uint16_t result) {
-    cpu->s.sign = MASK_SIGN(result);
-    cpu->s.zero = (result & 0xff) == 0 ? 1 : 0;
+static inline void cpu_subtract(Cpu *cpu, uint8_t value) {
+    if (cpu->p & FLAG_DECIMAL) {
+        cpu_setDecimalResult(cpu,
+                cpu_decimalSubtract[CPU_CARRY(cpu)][cpu->acc << 8 | value]);
+        return;
+    }
+    // A - M - borrow is A + ~M + carry, with carry out meaning no borrow.
+    uint8_t inverted = ~value;
+    uint16_t result = (uint16_t) cpu->acc + inverted + CPU_CARRY(cpu);
+    cpu_setArithmeticFlags(cpu, result, cpu->acc, inverted);
+    cpu->acc = result;
+}
+
+static inline void cpu_compare(Cpu *cpu, uint8_t reg, uint8_t value) {
+    cpu_setZNFlags(cpu, reg - value);
+    cpu_setCarry(cpu, reg >= value);
+}
+
+// N and V are copied from the operand; only Z looks at A.
+static inline void cpu_bit(Cpu *cpu, uint8_t value) {
+    cpu->flagN = value;
+    cpu->flagZ = cpu->acc & value;
+    cpu_setOverflow(cpu, value & FLAG_OVERFLOW);
+}
+
+// The stack lives in page one and sp wraps within it.
+static inline void cpu_push(Cpu *cpu, uint8_t value) {
+    cpu_write(cpu, cpu->sp, value);
+    cpu->sp = STACK_END | ((cpu->sp - 1) & 0xff);
+}
+
+static inline uint8_t cpu_pull(Cpu *cpu) {
+    cpu->sp = STACK_END | ((cpu->sp + 1) & 0xff);
+    return cpu_read(cpu, cpu->sp);
+}
+
+static inline uint8_t cpu_fetch(Cpu *cpu, uint16_t offset) {
+    return cpu_read(cpu, cpu->pc + offset);
 }
 
-static uint16_t cpu_fetchIIAX(Cpu *cpu, byte *buffer) {
-    uint8_t baseAddress = (uint8_t) buffer[cpu->pc + 1] + cpu->x;
-    return ((uint16_t) cpu->memory[baseAddress + 1] << 8) | 
-        cpu->memory[baseAddress];
+// Zero page pointers wrap within page zero, so ($ff,X) with X = 0 reads
+// its high byte from $00.
+static uint16_t cpu_fetchIIAX(Cpu *cpu) {
+    uint8_t baseAddress = (uint8_t) cpu_fetch(cpu, 1) + cpu->x;
+    return ((uint16_t) cpu_read(cpu, (uint8_t) (baseAddress + 1)) << 8) | 
+        cpu_read(cpu, baseAddress);
 }
 
-static uint16_t cpu_fetchIIAY(Cpu *cpu, byte *buffer) {
-    uint16_t address = (uint16_t) cpu->memory[buffer[cpu->pc + 1]] +
+static uint16_t cpu_fetchIIAY(Cpu *cpu, bool read) {
+    uint8_t pointer = cpu_fetch(cpu, 1);
+    uint16_t address = (uint16_t) cpu_read(cpu, pointer) +
         (uint16_t) cpu->y;
     uint8_t lower = cpu_lowerByte(address);
     uint8_t higher = MASK_CARRY(address) + 
-        (uint16_t) cpu->memory[buffer[cpu->pc + 1] + 1];
+        (uint16_t) cpu_read(cpu, (uint8_t) (pointer + 1));
+    // Reads take an extra cycle when the index carries into the high byte;
+    // stores always pay for it in their base count.
+    if (read) {
+        cpu->cycles += MASK_CARRY(address);
+    }
     address = cpu_toDWORD(higher, lower);
 
     return address;
 }
 
+static uint16_t cpu_fetchAbsIndexed(Cpu *cpu, uint8_t index, 
+        bool read) {
+    uint16_t base = cpu_toDWORD(cpu_fetch(cpu, 2), cpu_fetch(cpu, 1));
+    uint16_t address = base + index;
+    if (read) {
+        cpu->cycles += cpu_pageCrossed(base, address);
+    }
+
+    return address;
+}
+
+static uint8_t cpu_pageCrossed(uint16_t from, uint16_t to) {
+    return ((from ^ to) & 0xff00) != 0;
+}
+
+static void cpu_branch(Cpu *cpu, bool taken) {
+    uint16_t next = cpu->pc + 2;
+
+    if (taken) {
+        uint16_t target = next + (int8_t) cpu_fetch(cpu, 1);
+        cpu->cycles += 1 + cpu_pageCrossed(next, target);
+        cpu->pc = target;
+    } else {
+        cpu->pc = next;
+    }
+}
+
 static uint8_t cpu_lowerByte(uint16_t dword) {
     return (uint8_t) (dword & 0xff);
 }
@@ -75,2150 +351,2290 @@ static uint16_t cpu_toDWORD(uint8_t higher, uint8_t lower) {
     return (((uint16_t) higher) << 8) | ((uint16_t) lower);
 }
 
-static void cpu_setStateBit(Cpu *cpu, int bit) {
-    switch (bit) {
-        case 7:
-            cpu->s.sign = 1;
-            break;
-        case 6:
-            cpu->s.overflow = 1;
-            break;
-        case 4:
-            cpu->s.breakpoint = 1;
-            break;
-        case 3:
-            cpu->s.decimal = 1;
-            break;
-        case 2:
-            cpu->s.interrupt = 1;
-            break;
-        case 1:
-            cpu->s.zero = 1;
-            break;
-        case 0:
-            cpu->s.carry = 1;
-            break;
-    }
+// Remapping drops any write traps and loading bypasses them, so the next
+// snapshot can't trust what it shares with the previous one.
+static void cpu_invalidateSnapshot(Cpu *cpu) {
+    memset(cpu->snapshotDirty, 1, sizeof(cpu->snapshotDirty));
 }
 
-static void cpu_clearStateBit(Cpu *cpu, int bit) {
-    switch (bit) {
-        case 7:
-            cpu->s.sign = 0;
-            break;
-        case 6:
-            cpu->s.overflow = 0;
-            break;
-        case 4:
-            cpu->s.breakpoint = 0;
-            break;
-        case 3:
-            cpu->s.decimal = 0;
-            break;
-        case 2:
-            cpu->s.interrupt = 0;
-            break;
-        case 1:
-            cpu->s.zero = 0;
-            break;
-        case 0:
-            cpu->s.carry = 0;
-            break;
-    }
+static uint8_t cpu_openBusRead(Cpu *cpu, uint16_t address, void *context) {
+    (void) cpu;
+    (void) context;
+
+    // Nothing drives the data bus, so the last byte on it (the high byte
+    // of the address) is what gets read back.
+    return address >> 8;
 }
 
-static uint8_t cpu_stateToWord(Cpu *cpu) {
-    return (cpu->s.sign << 7) | (cpu->s.overflow << 6) | 
-        (cpu->s.breakpoint << 4) | (cpu->s.decimal << 3) | 
-        (cpu->s.interrupt << 2) | (cpu->s.zero << 1) | cpu->s.carry;
+static void cpu_ignoreWrite(Cpu *cpu, uint16_t address, uint8_t value, 
+        void *context) {
+    (void) cpu;
+    (void) address;
+    (void) value;
+    (void) context;
 }
 
-static void cpu_wordToState(Cpu *cpu, uint8_t word) {
-    cpu->s.sign = STATE_OVERFLOW(word);
-    cpu->s.overflow = STATE_SIGN(word);
-    cpu->s.breakpoint = STATE_BREAKPOINT(word);
-    cpu->s.decimal = STATE_DECIMAL(word);
-    cpu->s.interrupt = STATE_INTERRUPT(word);
-    cpu->s.zero = STATE_ZERO(word);
-    cpu->s.carry = STATE_CARRY(word);
+static void cpu_trapWrite(Cpu *cpu, uint16_t address, uint8_t value,
+        void *context) {
+    Page *page = &cpu->pages[address >> 8];
+    uint8_t *data = page->trapped;
+    (void) context;
+
+    // Other mirrors of the same backing page stay armed and trap once
+    // each; marking it dirty again is harmless.
+    if (data >= cpu->memory && data < cpu->memory + MAX_MEMORY) {
+        cpu->snapshotDirty[(data - cpu->memory) / PAGE_SIZE] = 1;
+    }
+#ifdef CPU_BLOCK_CACHE
+    // Data kept next to code, like a loop's counter, shouldn't cost the
+    // blocks around it; only a write to the code itself drops them.
+    const uint64_t *code = cpu->blockBytes[address >> 8];
+    uint8_t offset = address & 0xff;
+
+    if ((code[0] | code[1] | code[2] | code[3])
+            && !(code[offset >> 6] >> (offset & 63) & 1)) {
+        data[offset] = value;
+        return;
+    }
+    cpu_dropBlocks(cpu, data);
+#endif
+    page->write = data;
+    page->trapped = NULL;
+    page->write[address & 0xff] = value;
 }
 
 void cpu_initialize(Cpu *cpu) {
     memset(cpu, 0, sizeof(Cpu));
 
+    cpu_map2600(cpu);
+#ifndef __GNUC__
+    // Without constructors every Cpu refills the decimal tables, so set one
+    // up before starting threads that initialize others.
+    cpu_buildDecimalTables();
+#endif
+
     cpu->sp = STACK_START;
     cpu->pc = ROM_START;
+    cpu_setStatus(cpu, 0);
+    cpu_setJit(cpu, true);
+}
 
-    #ifdef DEBUG
-    printf("========== INITIAL STATE ==========\n\n");
-    printf("X: %x Y: %x ACC: %x SP: %x PC: %x\n", cpu->x, cpu->y, cpu->acc, 
-            cpu->sp, cpu->pc);
-    printf("\n===================================\n");
-    #endif
+// BRK
+static void cpu_opBrk(Cpu *cpu) {
+    // BRK skips a padding byte, so the return address is two past it.
+    uint16_t address = cpu->pc + 2;
+    cpu_push(cpu, cpu_higherByte(address));
+    cpu_push(cpu, cpu_lowerByte(address));
+    cpu_push(cpu, cpu_getStatus(cpu) | FLAG_BREAK);
+    cpu->p |= FLAG_INTERRUPT;
+    cpu->pc = (cpu_read(cpu, 0xffff) << 8) | cpu_read(cpu, 0xfffe);
 }
 
-int cpu_debugDecodeInstruction(Cpu *cpu, byte *buffer) { 
-    int pcOffset = 1;
-
-    switch(buffer[cpu->pc]) {
-        case 0x00: // BRK
-            {
-                #ifdef DEBUG
-                printf("BRK\n");
-                #endif 
-                pcOffset = 0;
-
-                uint16_t address = cpu->pc + 1;
-                cpu->memory[cpu->sp] = cpu_higherByte(address);
-                cpu->sp--;
-                cpu->memory[cpu->sp] = cpu_lowerByte(address);
-                cpu->sp--;
-                cpu->memory[cpu->sp] = cpu_stateToWord(cpu) | 0x10;
-                cpu->sp--;
-                cpu->pc = (cpu->memory[0xffff] << 8) | cpu->memory[0xfffe];
-            }
-            break;
-        case 0x01: // ORA ($NN, X)
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x05: // ORA $NN
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[buffer[cpu->pc + 1]];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x06: // ASL $NN
-            {
-                #ifdef DEBUG
-                printf("ASL $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint8_t address = buffer[cpu->pc + 1];
-                uint8_t result = (uint16_t) cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = result << 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x08: // PHP
-            {
-                #ifdef DEBUG
-                printf("PHP\n");
-                #endif 
-
-                cpu->memory[cpu->sp] = cpu_stateToWord(cpu);
-                cpu->sp--;
-            }
-            break;
-        case 0x09: // ORA #$NN
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x0a: // ASL A
-            {
-                #ifdef DEBUG
-                printf("ASL A\n");
-                #endif 
-
-                cpu->s.carry = MASK_SIGN(cpu->acc);
-                cpu->acc <<= 1;
-                cpu_setZNFlags(cpu, cpu->acc);
-            }
-            break;
-        case 0x0d: // ORA $NNNN
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x0e: // ASL $NNNN
-            {
-                #ifdef DEBUG
-                printf("ASL $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = result << 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x10: // BPL $NN
-            {
-                #ifdef DEBUG
-                printf("BPL $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (!cpu->s.sign) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0x11: // ORA ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result = cpu->acc | cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x15: // ORA $NN,X
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x16: // ASL $NN,X
-            {
-                #ifdef DEBUG
-                printf("ASL $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = result << 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x18: // CLC
-            {
-                #ifdef DEBUG
-                printf("CLC\n");
-                #endif
+// ORA ($NN,X)
+static void cpu_opOraIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
 
-                cpu->s.carry = 0;
-            }
-            break;
-        case 0x19: // ORA $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[address];
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x1d: // ORA $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("ORA $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->acc | 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x1e: // ASL $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("ASL $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = result << 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x20: // JSR $NNNN
-            {
-                #ifdef DEBUG
-                printf("JSR $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                //pcOffset = 3;
-                pcOffset = 0;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                cpu->memory[cpu->sp] = cpu_lowerByte(cpu->pc);
-                cpu->sp--;
-                cpu->memory[cpu->sp] = cpu_higherByte(cpu->pc);
-                cpu->sp--;
-                cpu->pc = address;
-            }
-            break;
-        case 0x21: // AND($NN,X)
-            {
-                #ifdef DEBUG
-                printf("AND ($%02x,X)\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x24: // BIT $NN
-            {
-                #ifdef DEBUG
-                printf("BIT $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = cpu->acc & cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->s.overflow = ((MASK_SIGN(cpu->acc) == 
-                            MASK_SIGN(cpu->memory[address])) &&
-                           (MASK_SIGN(cpu_lowerByte(result)) != 
-                            MASK_SIGN(cpu->acc)));
-            }
-            break;
-        case 0x25: // AND $NN
-            {
-                #ifdef DEBUG
-                printf("AND $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[buffer[cpu->pc + 1]];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x26: // ROL $NN
-            {
-                #ifdef DEBUG
-                printf("ROL $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint8_t address = buffer[cpu->pc + 1];
-                uint8_t result = (uint16_t) cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = (result << 1) | cpu->s.carry ;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x28: // PLP
-            {
-                #ifdef DEBUG
-                printf("PLP\n");
-                #endif
-
-                cpu->sp++;
-                cpu_wordToState(cpu, cpu->memory[cpu->sp]);
-            }
-            break;
-        case 0x29: // AND #$NN
-            {
-                #ifdef DEBUG
-                printf("AND #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x2a: // ROL A 
-            {
-                #ifdef DEBUG
-                printf("ROL A\n");
-                #endif
-
-                cpu->s.carry = MASK_SIGN(cpu->acc); 
-                cpu->acc = (cpu->acc << 1) | cpu->s.carry;
-                cpu_setZNFlags(cpu, cpu->acc);
-            }
-            break;
-        case 0x2c: // BIT $NNNN
-            {
-                #ifdef DEBUG
-                printf("BIT $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = cpu->acc & cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->s.overflow = ((MASK_SIGN(cpu->acc) == 
-                            MASK_SIGN(cpu->memory[address])) &&
-                           (MASK_SIGN(cpu_lowerByte(result)) != 
-                            MASK_SIGN(cpu->acc)));
-            }
-            break;
-        case 0x2d: // AND $NNNN
-            {
-                #ifdef DEBUG
-                printf("AND $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x2e: // ROL $NNNN
-            {
-                #ifdef DEBUG
-                printf("ROL $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = (result << 1) | cpu->s.carry;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x30: // BMI $NN
-            {
-                #ifdef DEBUG
-                printf("BMI $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (cpu->s.sign) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0x31: // AND ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("AND $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result = cpu->acc & cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x35: // AND $NN,X
-            {
-                #ifdef DEBUG
-                printf("AND $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x36: // ROL $NN,X
-            {
-                #ifdef DEBUG
-                printf("ROL $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = (result << 1) | cpu->s.carry;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x38: // SEC
-            {
-                #ifdef DEBUG
-                printf("SEC\n");
-                #endif 
+// ORA $NN
+static void cpu_opOraZp(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, cpu_fetch(cpu, 1));
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
 
-                cpu->s.carry = 1;
-            }
-            break;
-        case 0x39: // AND $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("AND $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[address];
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x3d: // AND $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("AND $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->acc & 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x3e: // ROL $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("ROL $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_SIGN(result);
-                cpu->memory[address] = (result << 1) | cpu->s.carry;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x40: // RTI
-            {
-                #ifdef DEBUG
-                printf("RTI\n");
-                #endif 
-                pcOffset = 0;
-
-                cpu->sp--;
-                cpu_wordToState(cpu, cpu->memory[cpu->sp]);
-                cpu->sp--;
-                uint8_t l = cpu->memory[cpu->sp];
-                cpu->sp--;
-                uint8_t h = cpu->memory[cpu->sp] << 8;
-                cpu->pc = h | l;
-            }
-            break;
-        case 0x41: // EOR($NN,X)
-            {
-                #ifdef DEBUG
-                printf("EOR $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x45: // EOR $NN
-            { 
-                #ifdef DEBUG
-                printf("EOR $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[buffer[cpu->pc + 1]];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x46: // LSR $NN
-            {
-                #ifdef DEBUG
-                printf("LSR $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint8_t address = buffer[cpu->pc + 1];
-                uint8_t result = (uint16_t) cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = result >> 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-                cpu_clearStateBit(cpu, 7);
-            }
-            break;
-        case 0x48: // PHA
-            {
-                #ifdef DEBUG
-                printf("PHA\n");
-                #endif
-
-                cpu->memory[cpu->sp] = cpu->acc;
-                cpu->sp--;
-            }
-            break;
-        case 0x49: // EOR #$NN
-            {
-                #ifdef DEBUG
-                printf("EOR #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x4a: // LSR A
-            {
-                #ifdef DEBUG
-                printf("LSR A\n");
-                #endif 
-
-                cpu->s.carry = MASK_BIT0(cpu->acc);
-                cpu->acc >>= 1;
-                cpu_setZNFlags(cpu, cpu->acc);
-                cpu_clearStateBit(cpu, 7);
-            }
-            break;
-        case 0x4c: // JMP $NNNN
-            {
-                #ifdef DEBUG
-                printf("JMP $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                //pcOffset = 3;
-                pcOffset = 0;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                cpu->pc = address;
-            }
-            break;
-        case 0x4d: // EOR $NNNN 
-            { 
-                #ifdef DEBUG
-                printf("EOR $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x4e: // LSR $NNNN
-            {
-                #ifdef DEBUG
-                printf("LSR $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = result >> 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-                cpu_clearStateBit(cpu, 7);
-            }
-            break;
-        case 0x50: // BVC $NN
-            {
-                #ifdef DEBUG
-                printf("BVC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (!cpu->s.overflow) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0x51: // EOR($NN),Y
-            {
-                #ifdef DEBUG
-                printf("EOR $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result = cpu->acc ^ cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x55: // EOR $NN,X
-            {
-                #ifdef DEBUG
-                printf("EOR $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
+// ASL $NN
+static void cpu_opAslZp(Cpu *cpu) {
+    uint8_t address = cpu_fetch(cpu, 1);
+    uint8_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = result << 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
 
-            }
-            break;
-        case 0x56: // LSR $NN,X
-            {
-                #ifdef DEBUG
-                printf("LSR $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = result >> 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-                cpu_clearStateBit(cpu, 7);
-            }
-            break;
-        case 0x58: // CLI
-            {
-                #ifdef DEBUG
-                printf("CLI\n");
-                #endif 
+// PHP
+static void cpu_opPhp(Cpu *cpu) {
+    cpu_push(cpu, cpu_getStatus(cpu) | FLAG_BREAK);
+    cpu->pc += 1;
+}
 
-                cpu->s.interrupt = 0;
-            }
-            break;
-        case 0x59: // EOR $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("EOR $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[address];
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x5d: // EOR $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("EOR $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->acc ^ 
-                    (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0x5e: // LSR $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("LSR $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = result >> 1;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-                cpu_clearStateBit(cpu, 7);
-            }
-            break;
-        case 0x60: // RTS
-            {
-                #ifdef DEBUG
-                printf("RTS\n");
-                #endif
-                pcOffset = 0;
-
-                cpu->sp++;
-                uint16_t address = cpu->memory[cpu->sp];
-                cpu->sp++;
-                address |= (cpu->memory[cpu->sp] << 8);
-                cpu->pc = address + 1;
-            }
-            break;
-        case 0x61: // ADC($NN,X)
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result;
-                if (cpu->s.decimal) {
-                    // TODO: Implement decimal add
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x65: // ADC $NN
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[buffer[cpu->pc + 1]] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x66: // ROR $NN
-            {
-                #ifdef DEBUG
-                printf("ROR $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint8_t address = buffer[cpu->pc + 1];
-                uint8_t result = (uint16_t) cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = (result >> 1) | (cpu->s.carry << 7) ;
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x68: // PLA
-            {
-                #ifdef DEBUG
-                printf("PLA\n");
-                #endif
-
-                cpu->sp++;
-                cpu->acc = cpu->memory[cpu->sp];
-            }
-            break;
-        case 0x69: // ADC #$NN
-            {
-                #ifdef DEBUG
-                printf("ADC #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-                
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) buffer[cpu->pc + 1] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x6a: // ROR A
-            {
-                #ifdef DEBUG
-                printf("ROR A\n");
-                #endif 
-
-                cpu->s.carry = MASK_BIT0(cpu->acc);
-                cpu->acc = (cpu->acc >> 1) | (cpu->s.carry << 7);
-                cpu_setZNFlags(cpu, cpu->acc);
-            }
-            break;
-        case 0x6c: // JMP $NN
-            {
-                #ifdef DEBUG
-                printf("JMP $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                //pcOffset = 2;
-                pcOffset = 0;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                cpu->pc = address;
-            }
-            break;
-        case 0x6d: // ADC $NNNN
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x6e: // ROR $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("ROR $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = (result >> 1) | (cpu->s.carry << 7);
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x70: // BVS $NN
-            {
-                #ifdef DEBUG
-                printf("BVS $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (cpu->s.overflow) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0x71: // ADC($NN),Y
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = cpu->acc + cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x75: // ADC $NN,X
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x76: // ROR $NN,X
-            {
-                #ifdef DEBUG
-                printf("ROR $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = (result >> 1) | (cpu->s.carry << 7);
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x78: // SEI
-            {
-                #ifdef DEBUG
-                printf("SEI\n");
-                #endif
+// ORA #$NN
+static void cpu_opOraImm(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
 
-                cpu->s.interrupt = 1;
-            }
-            break;
-        case 0x79: // ADC $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x7d: // ADC $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("ADC $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc + 
-                        (uint16_t) cpu->memory[address] + cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0x7e: // ROR $NNNN
-            {
-                #ifdef DEBUG
-                printf("ROR $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = cpu->memory[address];
-                cpu->s.carry = MASK_BIT0(result);
-                cpu->memory[address] = (result >> 1) | (cpu->s.carry << 7);
-                cpu_setZNFlags(cpu, cpu->memory[address]);
-            }
-            break;
-        case 0x81: // STA($NN,X)
-            {
-                #ifdef DEBUG
-                printf("STA $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x84: // STY $NN
-            {
-                #ifdef DEBUG
-                printf("STY $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->y;
-            }
-            break;
-        case 0x85: // STA $NN
-            {
-                #ifdef DEBUG
-                printf("STA $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x86: // STX $NN
-            {
-                #ifdef DEBUG
-                printf("STX $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->x;
-            }
-            break;
-        case 0x88: // DEY
-            {
-                #ifdef DEBUG
-                printf("DEY\n");
-                #endif
-
-                uint16_t result = (uint16_t) cpu->y - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;               
-            }
-            break;
-        case 0x8a: // TXA
-            {
-                #ifdef DEBUG
-                printf("TXA\n");
-                #endif
-
-                cpu->acc = cpu->x;
-                cpu_setZNFlags(cpu, cpu->acc); 
-            }
-            break;
-        case 0x8c: // STY $NNNN
-            {
-                #ifdef DEBUG
-                printf("STY $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                cpu->memory[address] = cpu->y;
-            }
-            break;
-        case 0x8d: // STA $NNNN
-            {
-                #ifdef DEBUG
-                printf("STA $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x8e: // STX $NNNN
-            {
-                #ifdef DEBUG
-                printf("STX $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                cpu->memory[address] = cpu->x;
-            }
-            break;
-        case 0x90: // BCC $NN
-            {
-                #ifdef DEBUG
-                printf("BCC $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (!cpu->s.carry) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0x91: // STA ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("STA $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x94: // STY $NN,X
-            {
-                #ifdef DEBUG
-                printf("STY $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->y;
-            }
-            break;
-        case 0x95: // STA $NN,X
-            {
-                #ifdef DEBUG
-                printf("STA $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x96: // STX $NN,Y
-            {
-                #ifdef DEBUG
-                printf("STX $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->y + (uint16_t) buffer[cpu->pc + 1];
-                cpu->memory[address] = cpu->x;
-            }
-            break;
-        case 0x98: // TYA
-            {
-                #ifdef DEBUG
-                printf("TYA\n");
-                #endif 
-
-                cpu->acc = cpu->y;
-                cpu_setZNFlags(cpu, cpu->acc); 
-            }
-            break;
-        case 0x99: // STA $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("STA $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0x9a: // TXS
-            {
-                #ifdef DEBUG
-                printf("TXS\n");
-                #endif 
+// ASL A
+static void cpu_opAslAcc(Cpu *cpu) {
+    cpu_setCarry(cpu, MASK_SIGN(cpu->acc));
+    cpu->acc <<= 1;
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// ORA $NNNN
+static void cpu_opOraAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// ASL $NNNN
+static void cpu_opAslAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = result << 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// BPL $NN
+static void cpu_opBpl(Cpu *cpu) {
+    cpu_branch(cpu, !CPU_SIGN(cpu));
+}
+
+// ORA ($NN),Y
+static void cpu_opOraIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    uint16_t result = cpu->acc | cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// ORA $NN,X
+static void cpu_opOraZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// ASL $NN,X
+static void cpu_opAslZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = result << 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// CLC
+static void cpu_opClc(Cpu *cpu) {
+    cpu_setCarry(cpu, false);
+    cpu->pc += 1;
+}
+
+// ORA $NNNN,Y
+static void cpu_opOraAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// ORA $NNNN,X
+static void cpu_opOraAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    uint16_t result = (uint16_t) cpu->acc |
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// ASL $NNNN,X
+static void cpu_opAslAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = result << 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// JSR $NNNN
+static void cpu_opJsr(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    // The pushed address is the last byte of the JSR; RTS adds one.
+    uint16_t last = cpu->pc + 2;
+    cpu_push(cpu, cpu_higherByte(last));
+    cpu_push(cpu, cpu_lowerByte(last));
+    cpu->pc = address;
+}
+
+// AND ($NN,X)
+static void cpu_opAndIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// BIT $NN
+static void cpu_opBitZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_bit(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// AND $NN
+static void cpu_opAndZp(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, cpu_fetch(cpu, 1));
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// ROL $NN
+static void cpu_opRolZp(Cpu *cpu) {
+    uint8_t address = cpu_fetch(cpu, 1);
+    uint8_t result = (uint16_t) cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = (result << 1) | carry;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// PLP
+static void cpu_opPlp(Cpu *cpu) {
+    cpu_setStatus(cpu, cpu_pull(cpu));
+    cpu->pc += 1;
+}
+
+// AND #$NN
+static void cpu_opAndImm(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// ROL A
+static void cpu_opRolAcc(Cpu *cpu) {
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_SIGN(cpu->acc));
+    cpu->acc = (cpu->acc << 1) | carry;
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// BIT $NNNN
+static void cpu_opBitAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_bit(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// AND $NNNN
+static void cpu_opAndAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// ROL $NNNN
+static void cpu_opRolAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = (result << 1) | carry;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// BMI $NN
+static void cpu_opBmi(Cpu *cpu) {
+    cpu_branch(cpu, CPU_SIGN(cpu));
+}
+
+// AND ($NN),Y
+static void cpu_opAndIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    uint16_t result = cpu->acc & cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// AND $NN,X
+static void cpu_opAndZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// ROL $NN,X
+static void cpu_opRolZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = (result << 1) | carry;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// SEC
+static void cpu_opSec(Cpu *cpu) {
+    cpu_setCarry(cpu, true);
+    cpu->pc += 1;
+}
+
+// AND $NNNN,Y
+static void cpu_opAndAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// AND $NNNN,X
+static void cpu_opAndAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    uint16_t result = (uint16_t) cpu->acc &
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// ROL $NNNN,X
+static void cpu_opRolAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_SIGN(result));
+    result = (result << 1) | carry;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// RTI
+static void cpu_opRti(Cpu *cpu) {
+    cpu_setStatus(cpu, cpu_pull(cpu));
+    uint8_t l = cpu_pull(cpu);
+    uint8_t h = cpu_pull(cpu);
+    cpu->pc = cpu_toDWORD(h, l);
+}
+
+// EOR ($NN,X)
+static void cpu_opEorIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// EOR $NN
+static void cpu_opEorZp(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, cpu_fetch(cpu, 1));
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LSR $NN
+static void cpu_opLsrZp(Cpu *cpu) {
+    uint8_t address = cpu_fetch(cpu, 1);
+    uint8_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = result >> 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// PHA
+static void cpu_opPha(Cpu *cpu) {
+    cpu_push(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// EOR #$NN
+static void cpu_opEorImm(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LSR A
+static void cpu_opLsrAcc(Cpu *cpu) {
+    cpu_setCarry(cpu, MASK_BIT0(cpu->acc));
+    cpu->acc >>= 1;
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// JMP $NNNN
+static void cpu_opJmpAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu->pc = address;
+}
+
+// EOR $NNNN
+static void cpu_opEorAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// LSR $NNNN
+static void cpu_opLsrAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = result >> 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// BVC $NN
+static void cpu_opBvc(Cpu *cpu) {
+    cpu_branch(cpu, !CPU_OVERFLOW(cpu));
+}
+
+// EOR ($NN),Y
+static void cpu_opEorIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    uint16_t result = cpu->acc ^ cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// EOR $NN,X
+static void cpu_opEorZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LSR $NN,X
+static void cpu_opLsrZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = result >> 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// CLI
+static void cpu_opCli(Cpu *cpu) {
+    cpu->p &= ~FLAG_INTERRUPT;
+    cpu->pc += 1;
+}
+
+// EOR $NNNN,Y
+static void cpu_opEorAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// EOR $NNNN,X
+static void cpu_opEorAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    uint16_t result = (uint16_t) cpu->acc ^
+        (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// LSR $NNNN,X
+static void cpu_opLsrAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = result >> 1;
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// RTS
+static void cpu_opRts(Cpu *cpu) {
+    uint16_t address = cpu_pull(cpu);
+    address |= cpu_pull(cpu) << 8;
+    cpu->pc = address + 1;
+}
+
+// ADC ($NN,X)
+static void cpu_opAdcIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// ADC $NN
+static void cpu_opAdcZp(Cpu *cpu) {
+    cpu_add(cpu, cpu_read(cpu, cpu_fetch(cpu, 1)));
+    cpu->pc += 2;
+}
+
+// ROR $NN
+static void cpu_opRorZp(Cpu *cpu) {
+    uint8_t address = cpu_fetch(cpu, 1);
+    uint8_t result = (uint16_t) cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = (result >> 1) | (carry << 7);
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// PLA
+static void cpu_opPla(Cpu *cpu) {
+    cpu->acc = cpu_pull(cpu);
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// ADC #$NN
+static void cpu_opAdcImm(Cpu *cpu) {
+    cpu_add(cpu, cpu_fetch(cpu, 1));
+    cpu->pc += 2;
+}
+
+// ROR A
+static void cpu_opRorAcc(Cpu *cpu) {
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_BIT0(cpu->acc));
+    cpu->acc = (cpu->acc >> 1) | (carry << 7);
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// JMP ($NNNN)
+static void cpu_opJmpInd(Cpu *cpu) {
+    uint16_t pointer = cpu_toDWORD(cpu_fetch(cpu, 2), cpu_fetch(cpu, 1));
+    // The NMOS part doesn't carry into the high byte of the pointer, so
+    // JMP ($xxff) takes its high byte from $xx00.
+    uint16_t next = (pointer & 0xff00) | ((pointer + 1) & 0x00ff);
+    cpu->pc = cpu_toDWORD(cpu_read(cpu, next), cpu_read(cpu, pointer));
+}
+
+// ADC $NNNN
+static void cpu_opAdcAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// ROR $NNNN
+static void cpu_opRorAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = (result >> 1) | (carry << 7);
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// BVS $NN
+static void cpu_opBvs(Cpu *cpu) {
+    cpu_branch(cpu, CPU_OVERFLOW(cpu));
+}
+
+// ADC ($NN),Y
+static void cpu_opAdcIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// ADC $NN,X
+static void cpu_opAdcZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// ROR $NN,X
+static void cpu_opRorZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = (result >> 1) | (carry << 7);
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 2;
+}
+
+// SEI
+static void cpu_opSei(Cpu *cpu) {
+    cpu->p |= FLAG_INTERRUPT;
+    cpu->pc += 1;
+}
+
+// ADC $NNNN,Y
+static void cpu_opAdcAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// ADC $NNNN,X
+static void cpu_opAdcAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    cpu_add(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// ROR $NNNN,X
+static void cpu_opRorAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = cpu_read(cpu, address);
+    uint8_t carry = CPU_CARRY(cpu);
+    cpu_setCarry(cpu, MASK_BIT0(result));
+    result = (result >> 1) | (carry << 7);
+    cpu_write(cpu, address, result);
+    cpu_setZNFlags(cpu, result);
+    cpu->pc += 3;
+}
+
+// STA ($NN,X)
+static void cpu_opStaIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 2;
+}
+
+// STY $NN
+static void cpu_opStyZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->y);
+    cpu->pc += 2;
+}
+
+// STA $NN
+static void cpu_opStaZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 2;
+}
+
+// STX $NN
+static void cpu_opStxZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->x);
+    cpu->pc += 2;
+}
+
+// DEY
+static void cpu_opDey(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->y - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 1;
+}
+
+// TXA
+static void cpu_opTxa(Cpu *cpu) {
+    cpu->acc = cpu->x;
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// STY $NNNN
+static void cpu_opStyAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_write(cpu, address, cpu->y);
+    cpu->pc += 3;
+}
+
+// STA $NNNN
+static void cpu_opStaAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 3;
+}
+
+// STX $NNNN
+static void cpu_opStxAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_write(cpu, address, cpu->x);
+    cpu->pc += 3;
+}
+
+// BCC $NN
+static void cpu_opBcc(Cpu *cpu) {
+    cpu_branch(cpu, !CPU_CARRY(cpu));
+}
+
+// STA ($NN),Y
+static void cpu_opStaIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, false);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 2;
+}
+
+// STY $NN,X
+static void cpu_opStyZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->y);
+    cpu->pc += 2;
+}
+
+// STA $NN,X
+static void cpu_opStaZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 2;
+}
+
+// STX $NN,Y
+static void cpu_opStxZpY(Cpu *cpu) {
+    uint8_t address = cpu->y + cpu_fetch(cpu, 1);
+    cpu_write(cpu, address, cpu->x);
+    cpu->pc += 2;
+}
+
+// TYA
+static void cpu_opTya(Cpu *cpu) {
+    cpu->acc = cpu->y;
+    cpu_setZNFlags(cpu, cpu->acc);
+    cpu->pc += 1;
+}
+
+// STA $NNNN,Y
+static void cpu_opStaAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, false);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 3;
+}
+
+// TXS
+static void cpu_opTxs(Cpu *cpu) {
+    cpu->sp = STACK_END | cpu->x;
+    cpu->pc += 1;
+}
+
+// STA $NNNN,X
+static void cpu_opStaAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    cpu_write(cpu, address, cpu->acc);
+    cpu->pc += 3;
+}
+
+// LDY #$NN
+static void cpu_opLdyImm(Cpu *cpu) {
+    uint16_t result = cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 2;
+}
+
+// LDA ($NN,X)
+static void cpu_opLdaIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LDX #$NN
+static void cpu_opLdxImm(Cpu *cpu) {
+    uint16_t result = cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 2;
+}
+
+// LDY $NN
+static void cpu_opLdyZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 2;
+}
+
+// LDA $NN
+static void cpu_opLdaZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LDX $NN
+static void cpu_opLdxZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 2;
+}
+
+// TAY
+static void cpu_opTay(Cpu *cpu) {
+    cpu->y = cpu->acc;
+    cpu_setZNFlags(cpu, cpu->y);
+    cpu->pc += 1;
+}
+
+// LDA #$NN
+static void cpu_opLdaImm(Cpu *cpu) {
+    uint16_t result = cpu_fetch(cpu, 1);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// TAX
+static void cpu_opTax(Cpu *cpu) {
+    cpu->x = cpu->acc;
+    cpu_setZNFlags(cpu, cpu->x);
+    cpu->pc += 1;
+}
+
+// LDY $NNNN
+static void cpu_opLdyAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 3;
+}
+
+// LDA $NNNN
+static void cpu_opLdaAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// LDX $NNNN
+static void cpu_opLdxAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 3;
+}
+
+// BCS $NN
+static void cpu_opBcs(Cpu *cpu) {
+    cpu_branch(cpu, CPU_CARRY(cpu));
+}
+
+// LDA ($NN),Y
+static void cpu_opLdaIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LDY $NN,X
+static void cpu_opLdyZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 2;
+}
+
+// LDA $NN,X
+static void cpu_opLdaZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 2;
+}
+
+// LDX $NN,Y
+static void cpu_opLdxZpY(Cpu *cpu) {
+    uint8_t address = cpu->y + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 2;
+}
+
+// CLV
+static void cpu_opClv(Cpu *cpu) {
+    cpu_setOverflow(cpu, false);
+    cpu->pc += 1;
+}
+
+// LDA $NNNN,Y
+static void cpu_opLdaAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// TSX
+static void cpu_opTsx(Cpu *cpu) {
+    cpu->x = (uint8_t) (cpu->sp & 0xff);
+    cpu_setZNFlags(cpu, cpu->x);
+    cpu->pc += 1;
+}
+
+// LDY $NNNN,X
+static void cpu_opLdyAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 3;
+}
+
+// LDA $NNNN,X
+static void cpu_opLdaAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    uint16_t result = (uint16_t) cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->acc = result;
+    cpu->pc += 3;
+}
+
+// LDX $NNNN,Y
+static void cpu_opLdxAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    uint16_t result = cpu_read(cpu, address);
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 3;
+}
+
+// CPY #$NN
+static void cpu_opCpyImm(Cpu *cpu) {
+    cpu_compare(cpu, cpu->y, cpu_fetch(cpu, 1));
+    cpu->pc += 2;
+}
+
+// CMP ($NN,X)
+static void cpu_opCmpIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// CPY $NN
+static void cpu_opCpyZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_compare(cpu, cpu->y, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// CMP $NN
+static void cpu_opCmpZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// DEC $NN
+static void cpu_opDecZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 2;
+}
+
+// INY
+static void cpu_opIny(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->y + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu->y = result;
+    cpu->pc += 1;
+}
+
+// CMP #$NN
+static void cpu_opCmpImm(Cpu *cpu) {
+    cpu_compare(cpu, cpu->acc, cpu_fetch(cpu, 1));
+    cpu->pc += 2;
+}
+
+// DEX
+static void cpu_opDex(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->x - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 1;
+}
+
+// CPY $NNNN
+static void cpu_opCpyAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_compare(cpu, cpu->y, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// CMP $NNNN
+static void cpu_opCmpAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// DEC $NNNN
+static void cpu_opDecAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2), cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu_read(cpu, address) - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 3;
+}
+
+// BNE $NN
+static void cpu_opBne(Cpu *cpu) {
+    cpu_branch(cpu, !CPU_ZERO(cpu));
+}
+
+// CMP ($NN),Y
+static void cpu_opCmpIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// CMP $NN,X
+static void cpu_opCmpZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// DEC $NN,X
+static void cpu_opDecZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 2;
+}
+
+// CLD
+static void cpu_opCld(Cpu *cpu) {
+    cpu->p &= ~FLAG_DECIMAL;
+    cpu->pc += 1;
+}
+
+// CMP $NNNN,Y
+static void cpu_opCmpAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// CMP $NNNN,X
+static void cpu_opCmpAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    cpu_compare(cpu, cpu->acc, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// DEC $NNNN,X
+static void cpu_opDecAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) - 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 3;
+}
+
+// CPX #$NN
+static void cpu_opCpxImm(Cpu *cpu) {
+    cpu_compare(cpu, cpu->x, cpu_fetch(cpu, 1));
+    cpu->pc += 2;
+}
+
+// SBC ($NN,X)
+static void cpu_opSbcIIAX(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAX(cpu);
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// CPX $NN
+static void cpu_opCpxZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    cpu_compare(cpu, cpu->x, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// SBC $NN
+static void cpu_opSbcZp(Cpu *cpu) {
+    cpu_subtract(cpu, cpu_read(cpu, cpu_fetch(cpu, 1)));
+    cpu->pc += 2;
+}
+
+// INC $NN
+static void cpu_opIncZp(Cpu *cpu) {
+    uint16_t address = cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 2;
+}
+
+// INX
+static void cpu_opInx(Cpu *cpu) {
+    uint16_t result = (uint16_t) cpu->x + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu->x = result;
+    cpu->pc += 1;
+}
+
+// SBC #$NN
+static void cpu_opSbcImm(Cpu *cpu) {
+    cpu_subtract(cpu, cpu_fetch(cpu, 1));
+    cpu->pc += 2;
+}
+
+// NOP
+static void cpu_opNop(Cpu *cpu) {
+    cpu->pc += 1;
+}
+
+// CPX $NNNN
+static void cpu_opCpxAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_compare(cpu, cpu->x, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// SBC $NNNN
+static void cpu_opSbcAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2),
+            cpu_fetch(cpu, 1));
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// INC $NNNN
+static void cpu_opIncAbs(Cpu *cpu) {
+    uint16_t address = cpu_toDWORD(cpu_fetch(cpu, 2), cpu_fetch(cpu, 1));
+    uint16_t result = (uint16_t) cpu_read(cpu, address) + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 3;
+}
+
+// BEQ $NN
+static void cpu_opBeq(Cpu *cpu) {
+    cpu_branch(cpu, CPU_ZERO(cpu));
+}
+
+// SBC ($NN),Y
+static void cpu_opSbcIIAY(Cpu *cpu) {
+    uint16_t address = cpu_fetchIIAY(cpu, true);
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// SBC $NN,X
+static void cpu_opSbcZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 2;
+}
+
+// INC $NN,X
+static void cpu_opIncZpX(Cpu *cpu) {
+    uint8_t address = cpu->x + cpu_fetch(cpu, 1);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 2;
+}
+
+// SED
+static void cpu_opSed(Cpu *cpu) {
+    cpu->p |= FLAG_DECIMAL;
+    cpu->pc += 1;
+}
+
+// SBC $NNNN,Y
+static void cpu_opSbcAbsY(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->y, true);
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// SBC $NNNN,X
+static void cpu_opSbcAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, true);
+    cpu_subtract(cpu, cpu_read(cpu, address));
+    cpu->pc += 3;
+}
+
+// INC $NNNN,X
+static void cpu_opIncAbsX(Cpu *cpu) {
+    uint16_t address = cpu_fetchAbsIndexed(cpu, cpu->x, false);
+    uint16_t result = (uint16_t) cpu_read(cpu, address) + 1;
+    cpu_setZNFlags(cpu, result);
+    cpu_write(cpu, address, result);
+    cpu->pc += 3;
+}
+
+static void cpu_opIllegal(Cpu *cpu) {
+    cpu->pc += 1;
+}
+
+typedef void (*CpuHandler)(Cpu *cpu);
+
+// Also consulted by cpu_run to spot illegal opcodes, so it exists even
+// when the switch does the dispatching.
+#define CPU_HANDLER(op, name, mnemonic, mode, cycles) [op] = cpu_op##name,
+static const CpuHandler cpu_handlers[256] = {
+    CPU_OPCODES(CPU_HANDLER)
+};
+#undef CPU_HANDLER
+
+static inline void cpu_dispatch(Cpu *cpu) {
+    uint8_t opcode = cpu_fetch(cpu, 0);
+
+    CPU_PROFILE_BEGIN(cpu, opcode)
+    cpu->cycles += cpu_cycleTable[opcode];
+#if CPU_DISPATCH == CPU_DISPATCH_SWITCH
+    switch (opcode) {
+        #define CPU_CASE(op, name, mnemonic, mode, cycles) case op: cpu_op##name(cpu); break;
+        CPU_OPCODES(CPU_CASE)
+        #undef CPU_CASE
+    }
+#else
+    cpu_handlers[opcode](cpu);
+#endif
+    CPU_PROFILE_END(cpu, opcode)
+}
+
+uint8_t cpu_getStatus(const Cpu *cpu) {
+    uint8_t status = (cpu->p & (FLAG_INTERRUPT | FLAG_DECIMAL)) | FLAG_UNUSED;
+
+    status |= cpu->flagN & FLAG_SIGN;
+    if (CPU_ZERO(cpu)) {
+        status |= FLAG_ZERO;
+    }
+    if (CPU_CARRY(cpu)) {
+        status |= FLAG_CARRY;
+    }
+    if (CPU_OVERFLOW(cpu)) {
+        status |= FLAG_OVERFLOW;
+    }
+
+    return status;
+}
+
+void cpu_setStatus(Cpu *cpu, uint8_t status) {
+    // B and bit 5 only exist on the stack copy of P; pulling P drops them.
+    cpu->p = status & (FLAG_INTERRUPT | FLAG_DECIMAL);
+    cpu->flagN = status;
+    cpu->flagZ = ~status & FLAG_ZERO;
+    cpu_setCarry(cpu, status & FLAG_CARRY);
+    cpu_setOverflow(cpu, status & FLAG_OVERFLOW);
+}
+
+void cpu_map2600(Cpu *cpu) {
+    cpu_beginMapping(cpu);
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        uint16_t address = (i << 8) & ADDRESS_MASK;
+
+        if (address & ROM_START) {
+            // A12 selects the cartridge; a 4K window repeated up the bus.
+            uint16_t rom = ROM_START | (address & (ROM_END - ROM_START));
+            cpu_mapMemory(cpu, i, 1, &cpu->memory[rom], false);
+        } else {
+            // A9 selects the RIOT page. Everything else folds onto page
+            // zero, which is why the stack at $01ff is RAM byte $ff.
+            uint16_t ram = address & RIOT_START;
+            cpu_mapMemory(cpu, i, 1, &cpu->memory[ram], true);
+        }
+    }
+    cpu_endMapping(cpu);
+}
+
+void cpu_mapFlat(Cpu *cpu) {
+    cpu_mapMemory(cpu, 0, PAGE_COUNT, cpu->memory, true);
+}
+
+void cpu_mapMemory(Cpu *cpu, uint8_t firstPage, int pageCount, 
+        uint8_t *data, bool writable) {
+    for (int i = 0; i < pageCount && firstPage + i < PAGE_COUNT; i++) {
+        Page *page = &cpu->pages[firstPage + i];
+        page->read = data + i * PAGE_SIZE;
+        page->write = writable ? page->read : NULL;
+        page->readHandler = NULL;
+        page->writeHandler = cpu_ignoreWrite;
+        page->context = NULL;
+        page->trapped = NULL;
+    }
+    cpu_mapped(cpu);
+}
+
+void cpu_mapDevice(Cpu *cpu, uint8_t firstPage, int pageCount, 
+        CpuReadHandler read, CpuWriteHandler write, void *context) {
+    for (int i = 0; i < pageCount && firstPage + i < PAGE_COUNT; i++) {
+        Page *page = &cpu->pages[firstPage + i];
+        page->read = NULL;
+        page->write = NULL;
+        page->readHandler = read ? read : cpu_openBusRead;
+        page->writeHandler = write ? write : cpu_ignoreWrite;
+        page->context = context;
+        page->trapped = NULL;
+    }
+    cpu_mapped(cpu);
+}
+
+void cpu_beginMapping(Cpu *cpu) {
+    cpu->mapping++;
+}
+
+void cpu_endMapping(Cpu *cpu) {
+    if (--cpu->mapping == 0) {
+        cpu_mapped(cpu);
+    }
+}
+
+// Blocks were decoded from, and snapshot traps armed on, the old mapping.
+static void cpu_mapped(Cpu *cpu) {
+    if (cpu->mapping == 0) {
+        cpu_invalidateSnapshot(cpu);
+        cpu_flushBlocks(cpu);
+    }
+}
+
+void cpu_armWriteTrap(Cpu *cpu, uint8_t page) {
+    Page *target = &cpu->pages[page];
+
+    if (target->write) {
+        target->trapped = target->write;
+        target->write = NULL;
+        target->writeHandler = cpu_trapWrite;
+#ifdef CPU_BLOCK_CACHE
+        memset(cpu->blockBytes[page], 0, sizeof(cpu->blockBytes[page]));
+#endif
+    }
+}
+
+void cpu_disarmWriteTraps(Cpu *cpu) {
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        Page *page = &cpu->pages[i];
+
+        if (page->trapped) {
+            page->write = page->trapped;
+            page->trapped = NULL;
+        }
+    }
+    // Cached blocks from writable pages counted on those traps.
+    cpu_flushBlocks(cpu);
+}
+
+void cpu_release(Cpu *cpu) {
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    jit_release(cpu);
+#else
+    (void) cpu;
+#endif
+}
+
+void cpu_setJit(Cpu *cpu, bool enabled) {
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    cpu->jitEnabled = enabled;
+#else
+    (void) cpu;
+    (void) enabled;
+#endif
+}
+
+void cpu_flushBlocks(Cpu *cpu) {
+#ifdef CPU_BLOCK_CACHE
+    for (int i = 0; i < CPU_BLOCK_CACHE_SIZE; i++) {
+        cpu->blocks[i].valid = false;
+    }
+    cpu->blockDropped = true;
+#endif
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    // Nothing compiles until compiled code running now has left, so the
+    // code it is in stays intact that long.
+    cpu->jitUsed = 0;
+#endif
+#ifndef CPU_BLOCK_CACHE
+    (void) cpu;
+#endif
+}
+
+int cpu_loadRom(Cpu *cpu, const byte *rom, size_t size) {
+    size_t window = ROM_END - ROM_START + 1;
+
+    if (size == 0 || size > window) {
+        return -1;
+    }
+
+    // 2K cartridges only decode the low address lines, so they show up
+    // mirrored across the whole ROM window.
+    if (window % size == 0) {
+        for (size_t offset = 0; offset < window; offset += size) {
+            memcpy(&cpu->memory[ROM_START + offset], rom, size);
+        }
+    } else {
+        memcpy(&cpu->memory[ROM_START], rom, size);
+    }
+    cpu_invalidateSnapshot(cpu);
+    cpu_flushBlocks(cpu);
 
-                cpu->sp = cpu->x;
-            }
-            break;
-        case 0x9d: // STA $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("STA $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                cpu->memory[address] = cpu->acc;
-            }
-            break;
-        case 0xa0: // LDY #$NN
-            {
-                #ifdef DEBUG
-                printf("LDY #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;
-            }
-            break;
-        case 0xa1: // LDA ($NN,X)
-            {
-                #ifdef DEBUG
-                printf("LDA ($%02x,X)\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xa2: // LDX #$NN
-            {
-                #ifdef DEBUG
-                printf("LDX #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
- 
-                uint16_t result = buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;
-            }
-            break;
-        case 0xa4: // LDY $NN
-            {
-                #ifdef DEBUG
-                printf("LDY $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;
-            }
-            break;
-        case 0xa5: // LDA $NN
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xa6: // LDX $NN
-            {
-                #ifdef DEBUG
-                printf("LDX $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;
-            }
-            break;
-        case 0xa8: // TAY
-            {
-                #ifdef DEBUG
-                printf("TAY\n");
-                #endif 
-
-                cpu->y = cpu->acc;
-                cpu_setZNFlags(cpu, cpu->y); 
-            }
-            break;
-        case 0xa9: // LDA #$NN
-            {
-                #ifdef DEBUG
-                printf("LDA #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xaa: // TAX
-            {
-                #ifdef DEBUG
-                printf("TAX\n");
-                #endif 
-
-                cpu->x = cpu->acc;
-                cpu_setZNFlags(cpu, cpu->x); 
-            }
-            break;
-        case 0xac: // LDY $NNNN
-            {
-                #ifdef DEBUG
-                printf("LDY $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;
-            }
-            break;
-        case 0xad: // LDA $NNNN
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xae: // LDX $NNNN
-            {
-                #ifdef DEBUG
-                printf("LDX $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;
-            }
-            break;
-        case 0xb0: // BCS $NN
-            {
-                #ifdef DEBUG
-                printf("BCS $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (cpu->s.carry) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0xb1: // LDA ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xb4: // LDY $NN,X
-            {
-                #ifdef DEBUG
-                printf("LDY $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;
-            }
-            break;
-        case 0xb5: // LDA $NN,X
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xb6: // LDX $NN,Y
-            {
-                #ifdef DEBUG
-                printf("LDX $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->y + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;
-            }
-            break;
-        case 0xb8: // CLV
-            {
-                #ifdef DEBUG
-                printf("CLV\n");
-                #endif
+    return 0;
+}
 
-                cpu->s.overflow = 0;
-            }
-            break;
-        case 0xb9: // LDA $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
-            }
-            break;
-        case 0xba: // TSX
-            {
-                #ifdef DEBUG
-                printf("TSX\n");
-                #endif 
+// The bytes are taken before the instruction runs, since it may switch
+// banks, and without reading through handlers, so tracing can't change
+// what the program does.
+void cpu_step(Cpu *cpu) {
+    uint16_t pc = cpu->pc;
+    byte instruction[3];
+
+    if (cpu->traceHook) {
+        for (int i = 0; i < 3; i++) {
+            instruction[i] = cpu_peek(cpu, pc + i);
+        }
+    }
+    cpu_dispatch(cpu);
+    if (cpu->traceHook) {
+        cpu->traceHook(cpu, pc, instruction, cpu->traceContext);
+    }
+}
 
-                cpu->x = (uint8_t) (cpu->sp & 0xff);
-            }
-            break;
-        case 0xbc: // LDY $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("LDY $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;
-            }
-            break;
-        case 0xbd: // LDA $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("LDA $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->acc = result;
+static inline bool cpu_isBreakpoint(const Cpu *cpu, uint16_t address) {
+    return cpu->breakpoints[address >> 3] & (1 << (address & 7));
+}
 
-            }
-            break;
-        case 0xbe: // LDX $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("LDX $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;
-            }
-            break;
-        case 0xc0: // CPY #$NN
-            {
-                #ifdef DEBUG
-                printf("CPY #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->y - 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xc1: // CMP($NN,X)
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xc4: // CPY $NN
-            {
-                #ifdef DEBUG
-                printf("CPY $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->y - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xc5: // CMP $NN
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xc6: // DEC $NN
-            {
-                #ifdef DEBUG
-                printf("DEC $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address] - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;               
-            }
-            break;
-        case 0xc8: // INY
-            {
-                #ifdef DEBUG
-                printf("INY\n");
-                #endif 
-
-                uint16_t result = (uint16_t) cpu->y + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->y = result;               
-            }
-            break;
-        case 0xc9: // CMP #$NN
-            {
-                #ifdef DEBUG
-                printf("CMP #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->acc - 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xca: // DEX
-            {
-                #ifdef DEBUG
-                printf("DEX\n");
-                #endif 
-
-                uint16_t result = (uint16_t) cpu->x - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;               
-            }
-            break;
-        case 0xcc: // CPY $NNNN
-            {
-                #ifdef DEBUG
-                printf("CPY $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->y - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xcd: // CMP $NNNN
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xce: // DEC $NNNN
-            {
-                #ifdef DEBUG
-                printf("DEC $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->memory[address] - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;      
-            }
-            break;
-        case 0xd0: // BNE $NN
-            {
-                #ifdef DEBUG
-                printf("BNE $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (!cpu->s.zero) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
-                }
-            }
-            break;
-        case 0xd1: // CMP ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
+#ifdef CPU_BLOCK_CACHE
+// Anything that can leave the straight line: branches, JMP, JSR, RTS and
+// RTI.
+static bool cpu_endsBlock(uint8_t opcode) {
+    switch (opcode) {
+        case 0x20:
+        case 0x40:
+        case 0x4c:
+        case 0x60:
+        case 0x6c:
+            return true;
+    }
+    return disasm_opcodes[opcode].mode == MODE_RELATIVE;
+}
 
-            }
-            break;
-        case 0xd5: // CMP $NN,X
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xd6: // DEC $NN,X
-            {
-                #ifdef DEBUG
-                printf("DEC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address] - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;
-            }
-            break;
-        case 0xd8: // CLD
-            { 
-                #ifdef DEBUG
-                printf("CLD\n");
-                #endif 
+// Decodes from start until something ends the block or an instruction
+// can't be cached: BRK and illegal opcodes (cpu_run stops on them),
+// breakpoints and bytes without backing memory (device pages). Only the
+// last instruction may run into the next page.
+static void cpu_buildBlock(Cpu *cpu, CpuBlock *block, uint16_t start) {
+    uint8_t firstPage = start >> 8;
+    uint16_t pc = start;
+
+    block->start = start;
+    block->valid = true;
+    block->count = 0;
+    block->idle = false;
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    block->entries = 0;
+    block->native = NULL;
+#endif
+    block->data[0] = cpu->pages[firstPage].read;
+    block->data[1] = block->data[0];
+    if (!block->data[0]) {
+        return;
+    }
 
-                cpu->s.decimal = 0;
-            }
-            break;
-        case 0xd9: // CMP $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xdd: // CMP $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("CMP $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->acc - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xde: // DEC $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("DEC $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->memory[address] - 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;               
-            }
-            break;
-        case 0xe0: // CPX #$NN
-            {
-                #ifdef DEBUG
-                printf("CPX #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result = (uint16_t) cpu->x - 
-                    (uint16_t) buffer[cpu->pc + 1];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xe1: // SBC($NN,X)
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAX(cpu, buffer);
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) cpu->memory[address] - !cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xe4: // CPX $NN
-            {
-                #ifdef DEBUG
-                printf("CPX $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->x - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xe6: // INC $NN
-            {
-                #ifdef DEBUG
-                printf("INC $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address] + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;               
-            }
-            break;
-        case 0xe8: // INX
-            {
-                #ifdef DEBUG
-                printf("INX\n");
-                #endif 
-
-                uint16_t result = (uint16_t) cpu->x + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->x = result;               
-            }
-            break;
-        case 0xe9: // SBC #$NN
-            {
-                #ifdef DEBUG
-                printf("SBC #$%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) buffer[cpu->pc + 1] - !cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xea: // NOP
-            {
-                #ifdef DEBUG
-                printf("NOP\n");
-                #endif 
-            }
-            break;
-        case 0xec: // CPX $NNNN
-            {
-                #ifdef DEBUG
-                printf("CPX $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->x - (uint16_t) cpu->memory[address];
-                cpu_setZNFlags(cpu, result);
-                if (result >= 0) {
-                    cpu_setStateBit(cpu, 0);
-                }
-            }
-            break;
-        case 0xed: // SBC $NNNN
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]);
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) cpu->memory[address] - !cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xee: // INC $NNNN
-            {
-                #ifdef DEBUG
-                printf("INC $%02x%02x\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                uint16_t result = (uint16_t) cpu->memory[address] + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;      
-            }
-            break;
-        case 0xf0: // BEQ $NN
-            {
-                #ifdef DEBUG
-                printf("BEQ $%02x\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                if (cpu->s.zero) {
-                    uint16_t address = buffer[cpu->pc + 1];
-                    cpu->pc += address - 2;
+    while (block->count < CPU_BLOCK_MAX && (pc >> 8) == firstPage) {
+        uint8_t opcode = cpu->pages[firstPage].read[pc & 0xff];
+        uint8_t lastPage = (uint16_t) (pc + disasm_opcodes[opcode].length - 1)
+            >> 8;
+
+        // cpu_run checks for breakpoints between instructions, so a block
+        // can start on one but not run into one.
+        if (opcode == 0x00 || cpu_handlers[opcode] == cpu_opIllegal
+                || (pc != start && cpu_isBreakpoint(cpu, pc))) {
+            break;
+        }
+        if (lastPage != firstPage) {
+            if (lastPage != (uint8_t) (firstPage + 1)
+                    || !cpu->pages[lastPage].read) {
+                break;
+            }
+            block->data[1] = cpu->pages[lastPage].read;
+        }
+
+        CpuBlockOp *op = &block->ops[block->count++];
+        op->handler = cpu_handlers[opcode];
+        op->cycles = cpu_cycleTable[opcode];
+        op->opcode = opcode;
+        op->fused = 0;
+        if (cpu_endsBlock(opcode) || lastPage != firstPage) {
+            break;
+        }
+        pc += disasm_opcodes[opcode].length;
+    }
+
+#ifndef CPU_PROFILE
+    cpu_fuseBlock(block);
+    block->idle = cpu_isIdleLoop(cpu, block);
+#endif
+    cpu_watchBlock(cpu, block);
+}
+
+// Profiles count every instruction by itself, so they go without fusion.
+#ifndef CPU_PROFILE
+// Idioms that make up much of real 6502 code, as X(first, second,
+// firstName, secondName): loads stored elsewhere, counted loops, additions
+// and subtractions with a fresh carry, and compares with their branch.
+#define CPU_FUSED_PAIRS(X) \
+    X(0xa9, 0x85, LdaImm, StaZp) \
+    X(0xa9, 0x8d, LdaImm, StaAbs) \
+    X(0xa9, 0x9d, LdaImm, StaAbsX) \
+    X(0xa9, 0x99, LdaImm, StaAbsY) \
+    X(0xa9, 0x91, LdaImm, StaIIAY) \
+    X(0xa5, 0x85, LdaZp, StaZp) \
+    X(0xa5, 0x8d, LdaZp, StaAbs) \
+    X(0xa5, 0x9d, LdaZp, StaAbsX) \
+    X(0xa5, 0x99, LdaZp, StaAbsY) \
+    X(0xa5, 0x91, LdaZp, StaIIAY) \
+    X(0xad, 0x85, LdaAbs, StaZp) \
+    X(0xad, 0x8d, LdaAbs, StaAbs) \
+    X(0xad, 0x9d, LdaAbs, StaAbsX) \
+    X(0xad, 0x99, LdaAbs, StaAbsY) \
+    X(0xad, 0x91, LdaAbs, StaIIAY) \
+    X(0xbd, 0x85, LdaAbsX, StaZp) \
+    X(0xbd, 0x8d, LdaAbsX, StaAbs) \
+    X(0xbd, 0x9d, LdaAbsX, StaAbsX) \
+    X(0xbd, 0x99, LdaAbsX, StaAbsY) \
+    X(0xbd, 0x91, LdaAbsX, StaIIAY) \
+    X(0xb9, 0x85, LdaAbsY, StaZp) \
+    X(0xb9, 0x8d, LdaAbsY, StaAbs) \
+    X(0xb9, 0x9d, LdaAbsY, StaAbsX) \
+    X(0xb9, 0x99, LdaAbsY, StaAbsY) \
+    X(0xb9, 0x91, LdaAbsY, StaIIAY) \
+    X(0xb1, 0x85, LdaIIAY, StaZp) \
+    X(0xb1, 0x8d, LdaIIAY, StaAbs) \
+    X(0xb1, 0x9d, LdaIIAY, StaAbsX) \
+    X(0xb1, 0x99, LdaIIAY, StaAbsY) \
+    X(0xb1, 0x91, LdaIIAY, StaIIAY) \
+    X(0xca, 0xd0, Dex, Bne) \
+    X(0x88, 0xd0, Dey, Bne) \
+    X(0xe8, 0xd0, Inx, Bne) \
+    X(0xc8, 0xd0, Iny, Bne) \
+    X(0x18, 0x69, Clc, AdcImm) \
+    X(0x18, 0x65, Clc, AdcZp) \
+    X(0x18, 0x75, Clc, AdcZpX) \
+    X(0x18, 0x6d, Clc, AdcAbs) \
+    X(0x18, 0x7d, Clc, AdcAbsX) \
+    X(0x18, 0x79, Clc, AdcAbsY) \
+    X(0x18, 0x71, Clc, AdcIIAY) \
+    X(0x38, 0xe9, Sec, SbcImm) \
+    X(0x38, 0xe5, Sec, SbcZp) \
+    X(0x38, 0xf5, Sec, SbcZpX) \
+    X(0x38, 0xed, Sec, SbcAbs) \
+    X(0x38, 0xfd, Sec, SbcAbsX) \
+    X(0x38, 0xf9, Sec, SbcAbsY) \
+    X(0x38, 0xf1, Sec, SbcIIAY) \
+    X(0xc9, 0xd0, CmpImm, Bne) \
+    X(0xc9, 0xf0, CmpImm, Beq) \
+    X(0xc9, 0x90, CmpImm, Bcc) \
+    X(0xc9, 0xb0, CmpImm, Bcs) \
+    X(0xc5, 0xd0, CmpZp, Bne) \
+    X(0xc5, 0xf0, CmpZp, Beq) \
+    X(0xc5, 0x90, CmpZp, Bcc) \
+    X(0xc5, 0xb0, CmpZp, Bcs) \
+    X(0xcd, 0xd0, CmpAbs, Bne) \
+    X(0xcd, 0xf0, CmpAbs, Beq) \
+    X(0xcd, 0x90, CmpAbs, Bcc) \
+    X(0xcd, 0xb0, CmpAbs, Bcs) \
+    X(0xe0, 0xd0, CpxImm, Bne) \
+    X(0xe0, 0xf0, CpxImm, Beq) \
+    X(0xc0, 0xd0, CpyImm, Bne) \
+    X(0xc0, 0xf0, CpyImm, Beq)
+
+// Both handlers in one, with the second's base cycles added in between as
+// cpu_runBlock would, so the compiler can keep values in registers across
+// them and there is one indirect call instead of two. If the first dropped
+// blocks, say a read that switched banks, the second may no longer be what
+// is at the pc, so it is left for whatever runs next.
+#define CPU_FUSE(first, second, firstName, secondName) \
+    static void cpu_fuse##firstName##secondName(Cpu *cpu) { \
+        cpu_op##firstName(cpu); \
+        if (cpu->blockDropped) { \
+            cpu->pairSplit = true; \
+            return; \
+        } \
+        cpu->cycles += cpu_cycleTable[second]; \
+        cpu_op##secondName(cpu); \
+        cpu->fusedOps++; \
+    }
+CPU_FUSED_PAIRS(CPU_FUSE)
+#undef CPU_FUSE
+
+static CpuHandler cpu_fusedHandler(uint8_t first, uint8_t second) {
+    switch (first << 8 | second) {
+        #define CPU_FUSED_CASE(first, second, firstName, secondName) \
+            case first << 8 | second: return cpu_fuse##firstName##secondName;
+        CPU_FUSED_PAIRS(CPU_FUSED_CASE)
+        #undef CPU_FUSED_CASE
+    }
+    return NULL;
+}
+
+// Greedily, left to right. The second op of a pair only runs through the
+// fused handler, but keeps its own for code that walks the ops one
+// instruction at a time.
+static void cpu_fuseBlock(CpuBlock *block) {
+    for (int i = 0; i + 1 < block->count; i++) {
+        CpuBlockOp *op = &block->ops[i];
+        CpuHandler fused = cpu_fusedHandler(op->opcode,
+                block->ops[i + 1].opcode);
+
+        if (fused) {
+            op->handler = fused;
+            op->fused = 1;
+            i++;
+        }
+    }
+}
+
+// Whether the instruction only changes registers and flags, reading memory
+// if at all from pages with backing memory: a read handler may have side
+// effects or return something else next time. Indexed reads can reach the
+// page after the operand's.
+static bool cpu_onlyReads(const Cpu *cpu, uint8_t opcode, uint16_t operand) {
+    static const char *const readers[] = {
+        "LDA", "LDX", "LDY", "CMP", "CPX", "CPY",
+        "BIT", "AND", "ORA", "EOR", "ADC", "SBC"
+    };
+    const OpcodeInfo *info = &disasm_opcodes[opcode];
+    uint8_t page = operand >> 8;
+
+    switch (info->mode) {
+        case MODE_IMPLIED:
+            // PHP, PLP, PHA and PLA; the rest that touch memory end blocks.
+            return opcode != 0x08 && opcode != 0x28 && opcode != 0x48
+                && opcode != 0x68;
+        case MODE_ACCUMULATOR:
+        case MODE_IMMEDIATE:
+            return true;
+        case MODE_ZERO_PAGE:
+        case MODE_ZERO_PAGE_X:
+        case MODE_ZERO_PAGE_Y:
+            if (!cpu->pages[0].read) {
+                return false;
+            }
+            break;
+        case MODE_ABSOLUTE:
+            if (!cpu->pages[page].read) {
+                return false;
+            }
+            break;
+        case MODE_ABSOLUTE_X:
+        case MODE_ABSOLUTE_Y:
+            if (!cpu->pages[page].read
+                    || !cpu->pages[(uint8_t) (page + 1)].read) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    for (size_t i = 0; i < sizeof(readers) / sizeof(readers[0]); i++) {
+        if (strcmp(info->mnemonic, readers[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// See CpuBlock. The operands come from the block's own pages, which have
+// backing memory, so reading them here has no side effects.
+static bool cpu_isIdleLoop(Cpu *cpu, const CpuBlock *block) {
+    uint16_t pc = block->start;
+
+    for (int i = 0; i < block->count; i++) {
+        uint8_t opcode = block->ops[i].opcode;
+        const OpcodeInfo *info = &disasm_opcodes[opcode];
+        uint16_t operand = 0;
+
+        if (info->length > 1) {
+            operand = cpu_read(cpu, pc + 1);
+        }
+        if (info->length > 2) {
+            operand |= (uint16_t) cpu_read(cpu, pc + 2) << 8;
+        }
+        if (i == block->count - 1) {
+            return info->mode == MODE_RELATIVE && (uint16_t) (pc + 2
+                    + (int8_t) operand) == block->start;
+        }
+        if (!cpu_onlyReads(cpu, opcode, operand)) {
+            return false;
+        }
+        pc += info->length;
+    }
+
+    return false;
+}
+#endif
+
+// Arms the write trap on every writable mapping of the block's backing
+// pages and marks the bytes it was decoded from on each. ROM has none, so
+// this only costs anything for code in RAM.
+static void cpu_watchBlock(Cpu *cpu, const CpuBlock *block) {
+    int first = block->start & 0xff;
+    int size = 0;
+
+    // An empty block is still decoded from the byte at its start.
+    for (int i = 0; i < block->count; i++) {
+        size += disasm_opcodes[block->ops[i].opcode].length;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        const Page *page = &cpu->pages[i];
+
+        if (page->write && (page->write == block->data[0]
+                    || page->write == block->data[1])) {
+            cpu_armWriteTrap(cpu, i);
+        }
+        if (!page->trapped || (page->trapped != block->data[0]
+                    && page->trapped != block->data[1])) {
+            continue;
+        }
+        for (int at = first; at < first + size; at++) {
+            if (page->trapped == block->data[at >> 8]) {
+                cpu->blockBytes[i][(at & 0xff) >> 6] |=
+                    (uint64_t) 1 << (at & 63);
+            }
+        }
+    }
+}
+
+static inline CpuBlock *cpu_findBlock(Cpu *cpu) {
+    uint16_t pc = cpu->pc;
+    CpuBlock *block = &cpu->blocks[CPU_BLOCK_SLOT(pc)];
+
+    if (!block->valid || block->start != pc) {
+        cpu_buildBlock(cpu, block, pc);
+    }
+    return block;
+}
+
+// Returns the number of instructions executed, which is short of the
+// block's count if one of them wrote to cached code or switched banks.
+static inline uint8_t cpu_runBlock(Cpu *cpu, const CpuBlock *block) {
+    const CpuBlockOp *next = block->ops;
+    const CpuBlockOp *end = block->ops + block->count;
+
+    cpu->blockDropped = false;
+    while (next < end) {
+        const CpuBlockOp *op = next;
+
+        // A fused op runs the one after it too.
+        next += 1 + op->fused;
+        CPU_PROFILE_BEGIN(cpu, op->opcode)
+        cpu->cycles += op->cycles;
+        op->handler(cpu);
+        CPU_PROFILE_END(cpu, op->opcode)
+        if (cpu->blockDropped) {
+            next -= cpu->pairSplit;
+            cpu->pairSplit = false;
+            break;
+        }
+    }
+
+    return next - block->ops;
+}
+
+static void cpu_saveRegisters(const Cpu *cpu, CpuRegisters *registers) {
+    registers->acc = cpu->acc;
+    registers->x = cpu->x;
+    registers->y = cpu->y;
+    registers->p = cpu->p;
+    registers->flagN = cpu->flagN;
+    registers->flagZ = cpu->flagZ;
+    registers->flagC = cpu->flagC;
+    registers->flagVAcc = cpu->flagVAcc;
+    registers->flagVOperand = cpu->flagVOperand;
+    registers->sp = cpu->sp;
+}
+
+static bool cpu_sameRegisters(const Cpu *cpu, const CpuRegisters *registers) {
+    return registers->acc == cpu->acc && registers->x == cpu->x
+        && registers->y == cpu->y && registers->p == cpu->p
+        && registers->flagN == cpu->flagN && registers->flagZ == cpu->flagZ
+        && registers->flagC == cpu->flagC
+        && registers->flagVAcc == cpu->flagVAcc
+        && registers->flagVOperand == cpu->flagVOperand
+        && registers->sp == cpu->sp;
+}
+
+// Runs an idle block once; it writes nothing, so it always runs whole. If
+// that brought it back to its start with the registers as they were, the
+// next iteration starts from the same state as this one, reading memory
+// nothing can have changed, so it and every one after it take the same
+// path and the same cycles. As many as fit strictly inside both limits are
+// counted without running them; cpu_run then runs the last few and stops
+// exactly where it would have. Nothing here raises events mid-run, so a
+// limit is the next thing that can end the wait. A breakpoint on the loop
+// stops every iteration instead. Returns the instructions executed,
+// skipped ones included.
+static uint64_t cpu_runIdle(Cpu *cpu, const CpuBlock *block,
+        uint64_t instructionsLeft, uint64_t cycleLimit, bool breakpoints) {
+    CpuRegisters before;
+    uint64_t start = cpu->cycles;
+    uint64_t cycles;
+    uint64_t iterations;
+
+    cpu_saveRegisters(cpu, &before);
+    cpu_runBlock(cpu, block);
+    cycles = cpu->cycles - start;
+
+    if (block->count == instructionsLeft || cpu->cycles >= cycleLimit
+            || cpu->pc != block->start || !cpu_sameRegisters(cpu, &before)
+            || (breakpoints && cpu_isBreakpoint(cpu, block->start))) {
+        return block->count;
+    }
+
+    iterations = (instructionsLeft - block->count - 1) / block->count;
+    if ((cycleLimit - cpu->cycles - 1) / cycles < iterations) {
+        iterations = (cycleLimit - cpu->cycles - 1) / cycles;
+    }
+    cpu->cycles += iterations * cycles;
+    cpu->idleInstructions += iterations * block->count;
+
+    return (iterations + 1) * block->count;
+}
+
+static void cpu_dropBlocks(Cpu *cpu, const uint8_t *data) {
+    for (int i = 0; i < CPU_BLOCK_CACHE_SIZE; i++) {
+        CpuBlock *block = &cpu->blocks[i];
+
+        if (block->valid
+                && (block->data[0] == data || block->data[1] == data)) {
+            block->valid = false;
+            cpu->blockDropped = true;
+        }
+    }
+}
+#endif
+
+// Checked before every instruction but the first, so a run that stopped on
+// a breakpoint can be resumed from it. Whether any breakpoints are set is
+// only sampled on entry; ones added from a device handler mid-run take
+// effect on the next call.
+#define CPU_RUN_CHECK(stop) \
+    if (executed == maxInstructions) { \
+        stop = CPU_STOP_INSTRUCTIONS; \
+    } else if (cpu->cycles >= cycleLimit) { \
+        stop = CPU_STOP_CYCLES; \
+    } else if (breakpoints && cpu_isBreakpoint(cpu, cpu->pc)) { \
+        stop = CPU_STOP_BREAKPOINT; \
+    }
+
+uint64_t cpu_run(Cpu *cpu, uint64_t maxInstructions, uint64_t maxCycles, 
+        CpuStopReason *stopReason) {
+    CpuStopReason stop = CPU_STOP_NONE;
+    uint64_t executed = 0;
+    uint64_t cycleLimit = cpu->cycles + maxCycles;
+    bool breakpoints = cpu->breakpointCount > 0;
+
+    // The last instruction may overshoot the cycle limit by a few cycles;
+    // the caller can carry the difference into its next slice.
+    if (cycleLimit < cpu->cycles) {
+        cycleLimit = CPU_RUN_UNLIMITED;
+    }
+
+    if (maxInstructions == 0) {
+        stop = CPU_STOP_INSTRUCTIONS;
+    } else if (maxCycles == 0) {
+        stop = CPU_STOP_CYCLES;
+    }
+
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED
+    if (!cpu->traceHook) {
+        // Every handler ends in its own indirect jump, so the branch
+        // predictor sees one site per opcode instead of a single shared one.
+        #define CPU_LABEL(op, name, mnemonic, mode, cycles) [op] = &&op_##op,
+        static void *const labels[256] = {
+            CPU_OPCODES(CPU_LABEL)
+        };
+        #undef CPU_LABEL
+
+        if (stop != CPU_STOP_NONE) {
+            goto done;
+        }
+        goto *labels[cpu_fetch(cpu, 0)];
+
+        // The opcode is a constant in each copy, so the BRK and illegal
+        // tests fold away everywhere but where they apply.
+        #define CPU_THREAD(op, name, mnemonic, mode, base) \
+        op_##op: \
+            if (cpu_op##name == cpu_opIllegal) { \
+                stop = CPU_STOP_ILLEGAL; \
+                goto done; \
+            } \
+            CPU_PROFILE_BEGIN(cpu, op) \
+            cpu->cycles += base; \
+            cpu_op##name(cpu); \
+            CPU_PROFILE_END(cpu, op) \
+            executed++; \
+            if (op == 0x00) { \
+                stop = CPU_STOP_BRK; \
+                goto done; \
+            } \
+            CPU_RUN_CHECK(stop) \
+            if (stop != CPU_STOP_NONE) { \
+                goto done; \
+            } \
+            goto *labels[cpu_fetch(cpu, 0)];
+        CPU_OPCODES(CPU_THREAD)
+        #undef CPU_THREAD
+    }
+#endif
+
+    while (stop == CPU_STOP_NONE) {
+#ifdef CPU_BLOCK_CACHE
+        // Whole blocks when neither limit can fall inside one and no trace
+        // hook needs to see single instructions; otherwise one at a time.
+        if (!cpu->traceHook) {
+            CpuBlock *block = cpu_findBlock(cpu);
+
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+            // Compiled code goes on from block to block by itself and only
+            // returns when it reaches uncompiled code or a limit. That skips
+            // the breakpoint checks, so it's not used with breakpoints set.
+            if (block->native && cpu->jitEnabled && !breakpoints) {
+                uint64_t ran = jit_run(cpu, block, maxInstructions - executed,
+                        cycleLimit);
+
+                if (ran > 0) {
+                    executed += ran;
+                    CPU_RUN_CHECK(stop)
+                    continue;
                 }
             }
-            break;
-        case 0xf1: // SBC ($NN),Y
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x,Y\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = cpu_fetchIIAY(cpu, buffer);
-                uint16_t result;
-                if (cpu->s.decimal) {
+#endif
+            if (block->count > 0 && block->count <= maxInstructions - executed
+                    && cpu->cycles + block->count * CPU_MAX_INSTRUCTION_CYCLES
+                        < cycleLimit) {
+                if (!block->idle) {
+                    executed += cpu_runBlock(cpu, block);
                 } else {
-                    result = cpu->acc - cpu->memory[address] - !cpu->s.carry;
+                    executed += cpu_runIdle(cpu, block,
+                            maxInstructions - executed, cycleLimit,
+                            breakpoints);
                 }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xf5: // SBC $NN,X
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) cpu->memory[address] - !cpu->s.carry;
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+                if (++block->entries == JIT_THRESHOLD && block->valid
+                        && cpu->jitEnabled) {
+                    jit_compile(cpu, block);
                 }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xf6: // INC $NN,X
-            {
-                #ifdef DEBUG
-                printf("INC $%02x,X\n", buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 2;
-                
-                uint16_t address = (uint16_t) cpu->x + (uint16_t) buffer[cpu->pc + 1];
-                uint16_t result = (uint16_t) cpu->memory[address] + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;
-            }
-            break;
-        case 0xf8: // SED
-            {
-                #ifdef DEBUG
-                printf("SED\n");
-                #endif 
+#endif
+                CPU_RUN_CHECK(stop)
+                continue;
+            }
+        }
+#endif
+        uint8_t opcode = cpu_fetch(cpu, 0);
+
+        if (cpu_handlers[opcode] == cpu_opIllegal) {
+            stop = CPU_STOP_ILLEGAL;
+            break;
+        }
+        if (cpu->traceHook) {
+            cpu_step(cpu);
+        } else {
+            cpu_dispatch(cpu);
+        }
+        executed++;
+        if (opcode == 0x00) {
+            stop = CPU_STOP_BRK;
+            break;
+        }
+        CPU_RUN_CHECK(stop)
+    }
 
-                cpu->s.decimal = 1;
-            }
-            break;
-        case 0xf9: // SBC $NNNN,Y
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x%02x,Y\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->y;
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) cpu->memory[address] - !cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
-            }
-            break;
-        case 0xfd: // SBC $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("SBC $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result;
-                if (cpu->s.decimal) {
-                } else {
-                    result = (uint16_t) cpu->acc - 
-                        (uint16_t) cpu->memory[address] - !cpu->s.carry;
-                }
-                cpu_setArithmeticFlags(cpu, result, cpu->acc);
-                cpu->acc = result;
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED
+done:
+#endif
+    if (stopReason) {
+        *stopReason = stop;
+    }
+    return executed;
+}
+
+#undef CPU_RUN_CHECK
+
+void cpu_setBreakpoint(Cpu *cpu, uint16_t address, bool enabled) {
+    uint8_t mask = 1 << (address & 7);
+    uint8_t *slot = &cpu->breakpoints[address >> 3];
+
+    if (enabled && !(*slot & mask)) {
+        *slot |= mask;
+        cpu->breakpointCount++;
+    } else if (!enabled && (*slot & mask)) {
+        *slot &= ~mask;
+        cpu->breakpointCount--;
+    } else {
+        return;
+    }
+    // Blocks are cut at the breakpoints there were when decoding them.
+    cpu_flushBlocks(cpu);
+}
+
+void cpu_setTraceHook(Cpu *cpu, CpuTraceHook hook, void *context) {
+    cpu->traceHook = hook;
+    cpu->traceContext = context;
+}
+
+void cpu_setDeviceState(Cpu *cpu, CpuDeviceSave save, CpuDeviceLoad load,
+        void *context) {
+    cpu->deviceSave = save;
+    cpu->deviceLoad = load;
+    cpu->deviceContext = context;
+}
+
+void cpu_saveDeviceState(const Cpu *cpu,
+        uint8_t state[CPU_DEVICE_STATE_SIZE]) {
+    memset(state, 0, CPU_DEVICE_STATE_SIZE);
+    if (cpu->deviceSave) {
+        cpu->deviceSave(cpu, state, cpu->deviceContext);
+    }
+}
+
+void cpu_loadDeviceState(Cpu *cpu, const uint8_t state[CPU_DEVICE_STATE_SIZE]) {
+    if (cpu->deviceLoad) {
+        cpu->deviceLoad(cpu, state, cpu->deviceContext);
+    }
+}
+
+void cpu_debugTrace(Cpu *cpu, uint16_t pc, const byte *instruction, 
+        void *context) {
+    DisasmInstruction decoded;
+    char text[DISASM_TEXT_SIZE];
+    (void) context;
+
+    disasm_decode(instruction, 3, pc, &decoded);
+    disasm_format(&decoded, text);
+    printf("%s\n", text);
+
+    printf("X: %02x Y: %02x ACC: %02x SP: %04x PC: %04x\n", cpu->x, cpu->y, 
+            cpu->acc, cpu->sp, cpu->pc);
+    uint8_t status = cpu_getStatus(cpu);
+    if (status & FLAG_SIGN) printf("N"); else printf("n");
+    if (status & FLAG_OVERFLOW) printf("V"); else printf("v");
+    if (status & FLAG_BREAK) printf("B"); else printf("b");
+    if (status & FLAG_DECIMAL) printf("D"); else printf("d");
+    if (status & FLAG_INTERRUPT) printf("I"); else printf("i");
+    if (status & FLAG_ZERO) printf("Z"); else printf("z");
+    if (status & FLAG_CARRY) printf("C"); else printf("c");
+    printf("\n");
+    #ifdef DEBUG_MEMORY_FOOTPRINT
+    printf("0000: ");
+    for (int i = 0; i < 32; i++) printf("%02x ", cpu_read(cpu, i));
+    printf("\n01df: ");
+    for (int i = 0; i < 32; i++) printf("%02x ", cpu_read(cpu, 0x01df + i));
+    printf("\n===================================\n");
+    #endif
+}
+
+#ifdef CPU_PROFILE
+static inline void cpu_profileBegin(Cpu *cpu, uint8_t opcode) {
+    cpu->profile.opcodes[opcode]++;
+    cpu->profile.pcs[cpu->pc]++;
+    cpu->profile.start = cpu->cycles;
+}
+
+static inline void cpu_profileEnd(Cpu *cpu, uint8_t opcode) {
+    uint64_t cycles = cpu->cycles - cpu->profile.start;
+
+    cpu->profile.opcodeCycles[opcode] += cycles;
+    cpu->profile.cycleHistogram[cycles < CPU_PROFILE_MAX_CYCLES
+        ? cycles : CPU_PROFILE_MAX_CYCLES]++;
+}
+
+void cpu_resetProfile(Cpu *cpu) {
+    memset(&cpu->profile, 0, sizeof(cpu->profile));
+}
+
+// Picks the indices of the largest nonzero counts, largest first, by
+// repeated scans; top is small next to what a sort would cost here.
+static int cpu_profileTop(const uint64_t *counts, size_t size, int top,
+        int *indices) {
+    int found = 0;
+
+    while (found < top) {
+        int best = -1;
+
+        for (size_t i = 0; i < size; i++) {
+            bool taken = false;
+            for (int j = 0; j < found && !taken; j++) {
+                taken = indices[j] == (int) i;
             }
-            break;
-        case 0xfe: // INC $NNNN,X
-            {
-                #ifdef DEBUG
-                printf("INC $%02x%02x,X\n", buffer[cpu->pc + 2], buffer[cpu->pc + 1]);
-                #endif 
-                pcOffset = 3;
-
-                uint16_t address = cpu_toDWORD(buffer[cpu->pc + 2], 
-                        buffer[cpu->pc + 1]) + (uint16_t) cpu->x;
-                uint16_t result = (uint16_t) cpu->memory[address] + 1;
-                cpu_setZNFlags(cpu, result);
-                cpu->memory[address] = result;
+            if (!taken && counts[i] && (best < 0 || counts[i] > counts[best])) {
+                best = i;
             }
+        }
+        if (best < 0) {
             break;
+        }
+        indices[found++] = best;
     }
 
-    #ifdef DEBUG
-    printf("X: %02x Y: %02x ACC: %02x SP: %04x PC: %04x\n", cpu->x, cpu->y, cpu->acc, 
-            cpu->sp, cpu->pc + pcOffset);
-    if (cpu->s.sign) printf("N"); else printf("n");
-    if (cpu->s.overflow) printf("V"); else printf("v");
-    if (cpu->s.breakpoint) printf("B"); else printf("b");
-    if (cpu->s.decimal) printf("D"); else printf("d");
-    if (cpu->s.interrupt) printf("I"); else printf("i");
-    if (cpu->s.zero) printf("Z"); else printf("z");
-    if (cpu->s.carry) printf("C"); else printf("c");
-    printf("\n");
-        #ifdef DEBUG_MEMORY_FOOTPRINT
-        printf("0000: ");
-        for (int i = 0; i < 32; i++) printf("%02x ", cpu->memory[i]);
-        printf("\n01df: ");
-        for (int i = 0; i < 32; i++) printf("%02x ", cpu->memory[0x01df + i]);
-        printf("\n===================================\n");
-        #endif
-    #endif
+    return found;
+}
+
+void cpu_dumpProfile(const Cpu *cpu, FILE *out, int top) {
+    const CpuProfile *profile = &cpu->profile;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t pageAccesses[PAGE_COUNT];
+    int indices[top > 0 ? top : 1];
+    int count;
+
+    for (int i = 0; i < 256; i++) {
+        instructions += profile->opcodes[i];
+        cycles += profile->opcodeCycles[i];
+    }
+    if (!instructions) {
+        fprintf(out, "profile: nothing executed\n");
+        return;
+    }
+
+    fprintf(out, "profile: %llu instructions, %llu cycles\n",
+            (unsigned long long) instructions, (unsigned long long) cycles);
+
+    fprintf(out, "opcodes:\n");
+    count = cpu_profileTop(profile->opcodes, 256, top, indices);
+    for (int i = 0; i < count; i++) {
+        int op = indices[i];
+        const char *mnemonic = disasm_opcodes[op].mnemonic;
 
-    return pcOffset;
+        fprintf(out, "  %02x %-3s %12llu %6.2f%% %5.2f cycles\n", op,
+                mnemonic ? mnemonic : "???",
+                (unsigned long long) profile->opcodes[op],
+                100.0 * profile->opcodes[op] / instructions,
+                (double) profile->opcodeCycles[op] / profile->opcodes[op]);
+    }
+
+    fprintf(out, "cycles per instruction:\n");
+    for (int i = 0; i <= CPU_PROFILE_MAX_CYCLES; i++) {
+        if (profile->cycleHistogram[i]) {
+            fprintf(out, "  %2d%s %12llu %6.2f%%\n", i,
+                    i == CPU_PROFILE_MAX_CYCLES ? "+" : " ",
+                    (unsigned long long) profile->cycleHistogram[i],
+                    100.0 * profile->cycleHistogram[i] / instructions);
+        }
+    }
+
+    fprintf(out, "addresses:\n");
+    count = cpu_profileTop(profile->pcs, MAX_MEMORY, top, indices);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "  $%04x %12llu %6.2f%%\n", indices[i],
+                (unsigned long long) profile->pcs[indices[i]],
+                100.0 * profile->pcs[indices[i]] / instructions);
+    }
+
+    fprintf(out, "pages:%14s %12s\n", "reads", "writes");
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        pageAccesses[i] = profile->pageReads[i] + profile->pageWrites[i];
+    }
+    count = cpu_profileTop(pageAccesses, PAGE_COUNT, top, indices);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "  $%02xxx %12llu %12llu\n", indices[i],
+                (unsigned long long) profile->pageReads[indices[i]],
+                (unsigned long long) profile->pageWrites[indices[i]]);
+    }
 }
+#endif
@@ -1,9 +1,55 @@
 #ifndef CPU_H_INCLUDED_
 #define CPU_H_INCLUDED_ 
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define MAX_MEMORY 8 * 1024
+#define MAX_MEMORY 0x10000
+
+#define CPU_DISPATCH_SWITCH 0
+#define CPU_DISPATCH_TABLE 1
+#define CPU_DISPATCH_THREADED 2
+#define CPU_DISPATCH_BLOCKS 3
+#define CPU_DISPATCH_JIT 4
+
+// Build with -DCPU_DISPATCH=CPU_DISPATCH_xxx to pick the interpreter loop.
+// The threaded loop needs computed goto and falls back to the switch on
+// compilers without it. The blocks loop decodes straight-line runs once
+// into a cache of handler calls; see CpuBlock. The JIT adds jit.c, which
+// compiles hot blocks to x86-64 code; elsewhere, and with CPU_PROFILE, it
+// falls back to blocks.
+#ifndef CPU_DISPATCH
+#ifdef __GNUC__
+#define CPU_DISPATCH CPU_DISPATCH_THREADED
+#else
+#define CPU_DISPATCH CPU_DISPATCH_SWITCH
+#endif
+#endif
+
+#if CPU_DISPATCH == CPU_DISPATCH_JIT && (!defined(__GNUC__) \
+        || !defined(__x86_64__) || defined(CPU_PROFILE))
+#undef CPU_DISPATCH
+#define CPU_DISPATCH CPU_DISPATCH_BLOCKS
+#endif
+
+#if CPU_DISPATCH == CPU_DISPATCH_BLOCKS || CPU_DISPATCH == CPU_DISPATCH_JIT
+#define CPU_BLOCK_CACHE
+#endif
+
+// Carry and overflow are derived from the last arithmetic result only when
+// something reads them. Build with -DCPU_EAGER_FLAGS to keep them as bits
+// in p and update them after every instruction instead.
+#ifndef CPU_EAGER_FLAGS
+#define CPU_LAZY_FLAGS
+#endif
+
+// Build with -DCPU_PROFILE to count executions per opcode and pc, cycles
+// per opcode and memory accesses per page. Without it the counters and
+// their updates compile away.
+#ifdef CPU_PROFILE
+#include <stdio.h>
+#endif
 
 #define RAM_START 0x80
 #define RAM_END 0xff
@@ -16,29 +62,294 @@
 #define STACK_START 0x01ff
 #define STACK_END 0x0100
 
+#define PAGE_SIZE 0x100
+#define PAGE_COUNT 0x100
+
+// The 6507 only brings out A0-A12, so the 2600 sees an 8K space
+// repeated eight times across the 16-bit range.
+#define ADDRESS_MASK 0x1fff
+
+#define FLAG_CARRY 0x01
+#define FLAG_ZERO 0x02
+#define FLAG_INTERRUPT 0x04
+#define FLAG_DECIMAL 0x08
+#define FLAG_BREAK 0x10
+#define FLAG_UNUSED 0x20
+#define FLAG_OVERFLOW 0x40
+#define FLAG_SIGN 0x80
+
 typedef unsigned char byte;
 
-typedef struct _state {
-    uint8_t sign:1; 
-    uint8_t overflow:1;
-    uint8_t breakpoint:1;
-    uint8_t decimal:1;
-    uint8_t interrupt:1;
-    uint8_t zero:1;
-    uint8_t carry:1;
-} State;
+struct _cpu;
+struct _snapshotPage;
+
+typedef void (*CpuTraceHook)(struct _cpu *cpu, uint16_t pc, 
+        const byte *instruction, void *context);
+typedef uint8_t (*CpuReadHandler)(struct _cpu *cpu, uint16_t address, 
+        void *context);
+typedef void (*CpuWriteHandler)(struct _cpu *cpu, uint16_t address, 
+        uint8_t value, void *context);
+
+// State kept by the devices mapped into a Cpu rather than in its memory,
+// such as a cartridge's selected bank, that snapshots and rewind carry
+// along: save fills a zeroed buffer of CPU_DEVICE_STATE_SIZE bytes and
+// load puts it back.
+#define CPU_DEVICE_STATE_SIZE 16
+typedef void (*CpuDeviceSave)(const struct _cpu *cpu, uint8_t *state,
+        void *context);
+typedef void (*CpuDeviceLoad)(struct _cpu *cpu, const uint8_t *state,
+        void *context);
+
+// One entry per 256-byte page of the address space. Plain RAM and ROM
+// pages set read (and write, if writable) to their backing bytes and are
+// accessed without a call; device pages leave them NULL and go through
+// the handlers instead. A page whose writes are being watched keeps its
+// write pointer in trapped and NULL in write until the first write lands
+// (see cpu_armWriteTrap).
+typedef struct _page {
+    uint8_t *read;
+    uint8_t *write;
+    CpuReadHandler readHandler;
+    CpuWriteHandler writeHandler;
+    void *context;
+    uint8_t *trapped;
+} Page;
+
+#define CPU_RUN_UNLIMITED UINT64_MAX
+
+// Why cpu_run returned. BRK stops after the instruction has executed; a
+// breakpoint or an illegal opcode stops before, leaving pc pointing at it.
+typedef enum _cpuStopReason {
+    CPU_STOP_NONE,
+    CPU_STOP_INSTRUCTIONS,
+    CPU_STOP_CYCLES,
+    CPU_STOP_BRK,
+    CPU_STOP_BREAKPOINT,
+    CPU_STOP_ILLEGAL
+} CpuStopReason;
+
+#ifdef CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE_SIZE 1024
+#define CPU_BLOCK_MAX 16
+// The most one instruction can take, penalties included, so a block of n
+// instructions is known to finish within n times this.
+#define CPU_MAX_INSTRUCTION_CYCLES 7
+// Which slot of Cpu.blocks a block starting at pc goes in.
+#define CPU_BLOCK_SLOT(pc) (((pc) ^ ((pc) >> 10)) & (CPU_BLOCK_CACHE_SIZE - 1))
+
+// fused is 1 when handler is a superinstruction that also runs the next
+// op, whose entry keeps its own handler for the JIT.
+typedef struct _cpuBlockOp {
+    void (*handler)(struct _cpu *cpu);
+    uint8_t cycles;
+    uint8_t opcode;
+    uint8_t fused;
+} CpuBlockOp;
+
+// A run of instructions starting at start, decoded once: up to and
+// including the first branch, jump, call or return, stopping short of BRK,
+// illegal opcodes, breakpoints and device pages. The handlers still read
+// their operands from memory, which the cache guarantees hasn't changed:
+// decoding arms the write trap on the backing pages (data), and the first
+// write through any mapping of them to a byte some block was decoded from
+// drops every block decoded from that page. A
+// slot with count 0 remembers that nothing at start can be cached. Common
+// pairs of instructions are fused into one handler when decoded.
+//
+// idle marks a loop that polls memory: a block that branches back to its
+// own start and otherwise only reads plain memory into registers, such as
+// a BIT/BPL wait. Once an iteration leaves the registers as it found
+// them, every later one does the same, so cpu_run can count them in bulk.
+//
+// With the JIT, entries counts how often the block ran through the
+// handlers; once it is hot, native holds its compiled code.
+typedef struct _cpuBlock {
+    const uint8_t *data[2];
+    uint16_t start;
+    bool valid;
+    uint8_t count;
+    bool idle;
+    CpuBlockOp ops[CPU_BLOCK_MAX];
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    uint32_t entries;
+    void *native;
+#endif
+} CpuBlock;
+#endif
+
+#ifdef CPU_PROFILE
+// Instructions taking more cycles than this share the histogram's last
+// bucket.
+#define CPU_PROFILE_MAX_CYCLES 15
+
+typedef struct _cpuProfile {
+    uint64_t opcodes[256];
+    uint64_t opcodeCycles[256];
+    uint64_t cycleHistogram[CPU_PROFILE_MAX_CYCLES + 1];
+    uint64_t pcs[MAX_MEMORY];
+    uint64_t pageReads[PAGE_COUNT];
+    uint64_t pageWrites[PAGE_COUNT];
+    // Cycle count when the instruction being counted started.
+    uint64_t start;
+} CpuProfile;
+#endif
 
 typedef struct _cpu {
     uint8_t acc;
     uint8_t x;
     uint8_t y;
-    State s;
+    // C, I, D and V are kept packed in p. N and Z are evaluated lazily:
+    // N is bit 7 of flagN and Z is set when flagZ is zero, so most
+    // instructions just store their result byte into both.
+    uint8_t p;
+    uint8_t flagN;
+    uint8_t flagZ;
+    // Only used with CPU_LAZY_FLAGS (the default), where C and V are kept
+    // as the last arithmetic result instead of bits in p: C is set when
+    // flagC exceeds a byte, V when bit 7 is set in both flagVAcc and
+    // flagVOperand (the inputs XORed with the result).
+    uint16_t flagC;
+    uint8_t flagVAcc;
+    uint8_t flagVOperand;
     uint16_t sp; // 0x01ff -> 0x0100
     uint16_t pc;
+    uint64_t cycles;
     uint8_t memory[MAX_MEMORY];
+    Page pages[PAGE_COUNT];
+    // Open cpu_beginMapping calls; see there.
+    int mapping;
+    CpuTraceHook traceHook;
+    void *traceContext;
+    CpuDeviceSave deviceSave;
+    CpuDeviceLoad deviceLoad;
+    void *deviceContext;
+    uint8_t breakpoints[MAX_MEMORY / 8];
+    int breakpointCount;
+    // Pages of memory[] as of the last snapshot taken or restored, and
+    // which of them have been written since. See snapshot.h.
+    struct _snapshotPage *snapshotPages[MAX_MEMORY / PAGE_SIZE];
+    uint8_t snapshotDirty[MAX_MEMORY / PAGE_SIZE];
+#ifdef CPU_BLOCK_CACHE
+    // Direct mapped by start address. blockDropped is raised when a write
+    // drops blocks, so a block that overwrote itself stops early. pairSplit
+    // is raised with it when that happened in the first half of a fused
+    // pair, which then skips its second.
+    CpuBlock blocks[CPU_BLOCK_CACHE_SIZE];
+    bool blockDropped;
+    bool pairSplit;
+    // A bit per byte of each page, set while it is trapped for the bytes
+    // cached blocks were decoded from, through any mirror; writes to the
+    // others land without dropping anything.
+    uint64_t blockBytes[PAGE_COUNT][PAGE_SIZE / 64];
+    // How many fused pairs have run, and how many instructions of idle
+    // loops were counted without running, to see what each is worth.
+    uint64_t fusedOps;
+    uint64_t idleInstructions;
+#endif
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    // Whether cpu_run uses compiled code, and the limits compiled code
+    // checks before entering each block while it runs.
+    bool jitEnabled;
+    uint64_t jitInstructionsLeft;
+    uint64_t jitCycleLimit;
+    // This Cpu's code space, mapped on its first compile, and how much of
+    // it blocks use. See cpu_release.
+    uint8_t *jitCode;
+    size_t jitUsed;
+#endif
+#ifdef CPU_PROFILE
+    CpuProfile profile;
+#endif
 } Cpu;
 
 void cpu_initialize(Cpu *cpu);
-int cpu_debugDecodeInstruction(Cpu *cpu, byte *buffer);
+// Gives back what the Cpu holds outside itself: the JIT's code space. Call
+// it before freeing a Cpu or initializing it again; it can still be used
+// afterwards and maps a new space when it needs one. A no-op unless built
+// with CPU_DISPATCH_JIT.
+void cpu_release(Cpu *cpu);
+uint8_t cpu_getStatus(const Cpu *cpu);
+void cpu_setStatus(Cpu *cpu, uint8_t status);
+void cpu_map2600(Cpu *cpu);
+void cpu_mapFlat(Cpu *cpu);
+void cpu_mapMemory(Cpu *cpu, uint8_t firstPage, int pageCount, 
+        uint8_t *data, bool writable);
+void cpu_mapDevice(Cpu *cpu, uint8_t firstPage, int pageCount, 
+        CpuReadHandler read, CpuWriteHandler write, void *context);
+// Every mapping change drops the cached blocks and the snapshot write
+// tracking. Between these two, changes only update the page table, and
+// the flush happens once when the outermost cpu_endMapping is called, so
+// remapping many single pages (a bank switch) costs one flush.
+void cpu_beginMapping(Cpu *cpu);
+void cpu_endMapping(Cpu *cpu);
+int cpu_loadRom(Cpu *cpu, const byte *rom, size_t size);
+void cpu_step(Cpu *cpu);
+uint64_t cpu_run(Cpu *cpu, uint64_t maxInstructions, uint64_t maxCycles, 
+        CpuStopReason *stopReason);
+void cpu_setBreakpoint(Cpu *cpu, uint16_t address, bool enabled);
+void cpu_setTraceHook(Cpu *cpu, CpuTraceHook hook, void *context);
+// One pair of device state hooks per Cpu; either may be NULL.
+void cpu_setDeviceState(Cpu *cpu, CpuDeviceSave save, CpuDeviceLoad load,
+        void *context);
+void cpu_saveDeviceState(const Cpu *cpu,
+        uint8_t state[CPU_DEVICE_STATE_SIZE]);
+void cpu_loadDeviceState(Cpu *cpu, const uint8_t state[CPU_DEVICE_STATE_SIZE]);
+void cpu_debugTrace(Cpu *cpu, uint16_t pc, const byte *instruction, 
+        void *context);
+// Write traps: the next write through an armed page marks its backing
+// page of memory[] dirty for snapshots and drops the blocks decoded from
+// it, then disarms the trap and lands. Pages with cached code stay armed
+// until a write hits the code itself.
+void cpu_armWriteTrap(Cpu *cpu, uint8_t page);
+void cpu_disarmWriteTraps(Cpu *cpu);
+// Drops every cached block. Needed after changing memory[] without
+// cpu_write; mapping and loading do it themselves. A no-op unless built
+// with CPU_DISPATCH_BLOCKS or CPU_DISPATCH_JIT.
+void cpu_flushBlocks(Cpu *cpu);
+// Turns the JIT on (the default) or off for this Cpu; off, it runs like
+// CPU_DISPATCH_BLOCKS. A no-op in other builds.
+void cpu_setJit(Cpu *cpu, bool enabled);
+#ifdef CPU_PROFILE
+void cpu_resetProfile(Cpu *cpu);
+// Writes the top entries of each counter, most frequent first.
+void cpu_dumpProfile(const Cpu *cpu, FILE *out, int top);
+#endif
+
+static inline uint8_t cpu_read(Cpu *cpu, uint16_t address) {
+    const Page *page = &cpu->pages[address >> 8];
+
+#ifdef CPU_PROFILE
+    cpu->profile.pageReads[address >> 8]++;
+#endif
+    if (page->read) {
+        return page->read[address & 0xff];
+    }
+    return page->readHandler(cpu, address, page->context);
+}
+
+// Reads a byte for a debugger or trace without touching the bus: memory
+// pages as cpu_read would, device pages as open bus, since their handlers
+// may have side effects (bank switching) and only they know the value.
+static inline uint8_t cpu_peek(const Cpu *cpu, uint16_t address) {
+    const Page *page = &cpu->pages[address >> 8];
+
+    if (page->read) {
+        return page->read[address & 0xff];
+    }
+    return address >> 8;
+}
+
+static inline void cpu_write(Cpu *cpu, uint16_t address, uint8_t value) {
+    const Page *page = &cpu->pages[address >> 8];
+
+#ifdef CPU_PROFILE
+    cpu->profile.pageWrites[address >> 8]++;
+#endif
+    if (page->write) {
+        page->write[address & 0xff] = value;
+    } else {
+        page->writeHandler(cpu, address, value, page->context);
+    }
+}
 
 #endif /* CPU_H_INCLUDED_ */
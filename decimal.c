@@ -0,0 +1,188 @@
+/*
+ * Exhaustive check of decimal mode ADC and SBC: every accumulator, operand
+ * and carry-in, 262144 cases, run through cpu_step and compared with an
+ * independent model of the NMOS 6502 written from Bruce Clark's "Decimal
+ * Mode" tutorial (6502.org), appendix A.
+ *
+ *   cc -O2 -o decimal decimal.c cpu.c disasm.c
+ *   ./decimal [-v]
+ *
+ * Each case runs as the immediate and the zero page form, which go
+ * through different handlers. A, N, V, Z and C are compared, and the rest
+ * of P has to come through untouched. The flag evaluation is fixed at
+ * build time, so build once more with -DCPU_EAGER_FLAGS to cover both.
+ * -v prints every failing case instead of the first few.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+#define DECIMAL_CODE 0x0200
+#define DECIMAL_OPERAND 0x10
+#define DECIMAL_REPORTED 10
+
+typedef struct _decimalResult {
+    uint8_t acc;
+    uint8_t status;
+} DecimalResult;
+
+typedef struct _decimalOp {
+    const char *name;
+    uint8_t immediate;
+    uint8_t zeroPage;
+    DecimalResult (*model)(uint8_t acc, uint8_t operand, bool carry);
+} DecimalOp;
+
+static DecimalResult decimal_adc(uint8_t acc, uint8_t operand, bool carry);
+static DecimalResult decimal_sbc(uint8_t acc, uint8_t operand, bool carry);
+static uint8_t decimal_flags(bool negative, bool overflow, bool zero,
+        bool carry);
+static DecimalResult decimal_run(Cpu *cpu, uint8_t opcode, uint8_t acc,
+        uint8_t operand, bool carry);
+
+static const DecimalOp decimal_ops[] = {
+    { "adc", 0x69, 0x65, decimal_adc },
+    { "sbc", 0xe9, 0xe5, decimal_sbc },
+};
+
+// Bits of P other than N, V, Z and C, which neither instruction touches.
+static const uint8_t decimal_kept = FLAG_DECIMAL | FLAG_INTERRUPT
+    | FLAG_UNUSED;
+
+static uint8_t decimal_flags(bool negative, bool overflow, bool zero,
+        bool carry) {
+    return (negative ? FLAG_SIGN : 0) | (overflow ? FLAG_OVERFLOW : 0)
+        | (zero ? FLAG_ZERO : 0) | (carry ? FLAG_CARRY : 0);
+}
+
+// N and V come from the sum before the high digit is adjusted, Z from the
+// binary sum and C from the adjusted one.
+static DecimalResult decimal_adc(uint8_t acc, uint8_t operand, bool carry) {
+    DecimalResult result;
+    int low = (acc & 0x0f) + (operand & 0x0f) + carry;
+    int sum;
+    int signedSum;
+
+    if (low >= 0x0a) {
+        low = ((low + 0x06) & 0x0f) + 0x10;
+    }
+    sum = (acc & 0xf0) + (operand & 0xf0) + low;
+    signedSum = (int8_t) (acc & 0xf0) + (int8_t) (operand & 0xf0) + low;
+
+    bool negative = sum & 0x80;
+    bool overflow = signedSum < -128 || signedSum > 127;
+    bool zero = ((acc + operand + carry) & 0xff) == 0;
+
+    if (sum >= 0xa0) {
+        sum += 0x60;
+    }
+    result.acc = sum & 0xff;
+    result.status = decimal_flags(negative, overflow, zero, sum >= 0x100);
+    return result;
+}
+
+// The flags are those of the binary subtraction.
+static DecimalResult decimal_sbc(uint8_t acc, uint8_t operand, bool carry) {
+    DecimalResult result;
+    int binary = acc - operand - !carry;
+    int low = (acc & 0x0f) - (operand & 0x0f) + carry - 1;
+    int difference;
+
+    if (low < 0) {
+        low = ((low - 0x06) & 0x0f) - 0x10;
+    }
+    difference = (acc & 0xf0) - (operand & 0xf0) + low;
+    if (difference < 0) {
+        difference -= 0x60;
+    }
+
+    bool overflow = ((acc ^ operand) & (acc ^ binary) & 0x80) != 0;
+
+    result.acc = difference & 0xff;
+    result.status = decimal_flags(binary & 0x80, overflow,
+            (binary & 0xff) == 0, binary >= 0);
+    return result;
+}
+
+static DecimalResult decimal_run(Cpu *cpu, uint8_t opcode, uint8_t acc,
+        uint8_t operand, bool carry) {
+    DecimalResult result;
+
+    cpu->memory[DECIMAL_CODE] = opcode;
+    if (opcode == 0x65 || opcode == 0xe5) {
+        cpu->memory[DECIMAL_CODE + 1] = DECIMAL_OPERAND;
+        cpu->memory[DECIMAL_OPERAND] = operand;
+    } else {
+        cpu->memory[DECIMAL_CODE + 1] = operand;
+    }
+
+    cpu->pc = DECIMAL_CODE;
+    cpu->acc = acc;
+    cpu_setStatus(cpu, decimal_kept | (carry ? FLAG_CARRY : 0));
+    cpu_step(cpu);
+
+    result.acc = cpu->acc;
+    result.status = cpu_getStatus(cpu);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    Cpu *cpu = malloc(sizeof(Cpu));
+    long failures = 0;
+
+    if (!cpu) {
+        perror("decimal");
+        return 1;
+    }
+    cpu_initialize(cpu);
+    cpu_mapFlat(cpu);
+
+    for (size_t i = 0; i < sizeof(decimal_ops) / sizeof(decimal_ops[0]);
+            i++) {
+        const DecimalOp *op = &decimal_ops[i];
+        uint8_t opcodes[2] = { op->immediate, op->zeroPage };
+        long failed = 0;
+        long runs = 0;
+
+        for (int mode = 0; mode < 2; mode++) {
+            for (int carry = 0; carry < 2; carry++) {
+                for (int acc = 0; acc < 256; acc++) {
+                    for (int operand = 0; operand < 256; operand++) {
+                        DecimalResult expected = op->model(acc, operand,
+                                carry);
+                        DecimalResult actual = decimal_run(cpu,
+                                opcodes[mode], acc, operand, carry);
+                        uint8_t status = actual.status & ~FLAG_BREAK;
+
+                        expected.status |= decimal_kept;
+                        runs++;
+                        if (actual.acc == expected.acc
+                                && status == expected.status) {
+                            continue;
+                        }
+                        if (verbose || failed < DECIMAL_REPORTED) {
+                            printf("%s $%02x: A=%02x M=%02x C=%d: got "
+                                    "A=%02x P=%02x, expected A=%02x "
+                                    "P=%02x\n", op->name, opcodes[mode],
+                                    acc, operand, carry, actual.acc,
+                                    status, expected.acc,
+                                    expected.status);
+                        }
+                        failed++;
+                    }
+                }
+            }
+        }
+
+        printf("%s: %ld runs, %ld failed\n", op->name, runs, failed);
+        failures += failed;
+    }
+
+    cpu_release(cpu);
+    free(cpu);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,692 @@
+/*
+ * Differential test of the fast dispatch paths against the plain
+ * interpreter, on random programs.
+ *
+ *   cc -O2 -DCPU_DISPATCH=CPU_DISPATCH_JIT -o differential \
+ *       differential.c cpu.c jit.c disasm.c rewind.c rom.c snapshot.c
+ *   ./differential [-f first] [-s seeds] [-n instructions] [-v]
+ *
+ * Every seed generates a program and runs it several times from the same
+ * start: once with a trace hook set, which makes cpu_run step through
+ * cpu_step one instruction at a time, and then the way the build normally
+ * runs, through the threaded code or the block cache, and in JIT builds
+ * once more with the JIT on. All runs take the same slices, with
+ * instruction and cycle limits, a breakpoint, restarts after BRK and
+ * illegal opcodes, the code space released a quarter of the way in and a
+ * snapshot restored midway, and have to end in the same state: registers,
+ * cycles, instructions, memory and bank.
+ *
+ * Then the program is recorded with rewind under a few byte budgets, from
+ * one that holds a handful of points to one that holds them all, and
+ * every point still held has to match a straight run when sought to,
+ * backwards, forwards and out of order, and again after going back
+ * halfway and running on from there.
+ *
+ * A program is a random mix of instructions with short forward branches,
+ * subroutine calls, pushes and pulls and, on half the seeds, small polling
+ * loops. Every third seed runs it from RAM in a flat map, with stores
+ * landing in its own code; the others build an F8 or F6 cart mapped
+ * through rom_map, with loads and stores hitting the hotspots so banks
+ * switch under the code.
+ * Build with -DCPU_EAGER_FLAGS and with -DJIT_THRESHOLD=1 as well to
+ * cover those.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "disasm.h"
+#include "jit.h"
+#include "rewind.h"
+#include "rom.h"
+#include "snapshot.h"
+
+#define DIFFERENTIAL_SEEDS 200
+#define DIFFERENTIAL_INSTRUCTIONS 400000
+// Where the main body ends and the four subroutines start, in the window.
+#define DIFFERENTIAL_BODY_END 0xb00
+#define DIFFERENTIAL_SUBROUTINES 0xc00
+#define DIFFERENTIAL_SUBROUTINE_SIZE 0x40
+// Enough restarts to tell a program that only ever hits BRK.
+#define DIFFERENTIAL_MAX_STOPS 20000
+#define DIFFERENTIAL_BREAKPOINT (ROM_START + 37)
+// Points the rewind pass records per run, and the budgets it records them
+// under: from one that keeps a few of them to one that keeps them all.
+#define DIFFERENTIAL_POINTS 48
+static const size_t differential_budgets[] = {
+    8 << 10, 64 << 10, 16 << 20
+};
+
+typedef enum _differentialMode {
+    DIFFERENTIAL_STEP,
+    DIFFERENTIAL_RUN,
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    DIFFERENTIAL_JIT,
+#endif
+    DIFFERENTIAL_MODES
+} DifferentialMode;
+
+static const char *const differential_modeNames[DIFFERENTIAL_MODES] = {
+    "step",
+    "run",
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    "jit",
+#endif
+};
+
+// What a run has to agree on.
+typedef struct _differentialState {
+    uint64_t executed;
+    int stops;
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t status;
+    uint16_t sp;
+    uint16_t pc;
+    uint64_t cycles;
+    uint32_t memory;
+    int bank;
+} DifferentialState;
+
+typedef struct _differentialProgram {
+    byte image[4 * ROM_WINDOW_SIZE];
+    size_t size;
+    bool banked;
+    bool breakpoint;
+    char path[32];
+} DifferentialProgram;
+
+static uint32_t differential_random(uint32_t *state);
+static int differential_below(uint32_t *state, int bound);
+static bool differential_plain(uint8_t opcode, bool decimal);
+static bool differential_reader(uint8_t opcode, bool decimal);
+static size_t differential_instruction(byte *out, uint32_t *state,
+        bool decimal, bool banked, bool (*allowed)(uint8_t, bool));
+static void differential_generate(byte *window, uint32_t *state,
+        bool decimal, bool banked, bool polls);
+static int differential_build(DifferentialProgram *program, uint32_t seed);
+static void differential_ignore(Cpu *cpu, uint16_t pc,
+        const byte *instruction, void *context);
+static Cpu *differential_load(const DifferentialProgram *program, Rom *rom);
+static void differential_unload(const DifferentialProgram *program,
+        Cpu *cpu, Rom *rom);
+static void differential_capture(const DifferentialProgram *program,
+        const Cpu *cpu, const Rom *rom, DifferentialState *state);
+static int differential_run(const DifferentialProgram *program,
+        DifferentialMode mode, uint64_t instructions,
+        DifferentialState *state);
+static int differential_rewind(const DifferentialProgram *program,
+        size_t budget, uint64_t instructions, bool verbose);
+static int differential_seek(const DifferentialProgram *program,
+        RewindBuffer *rewind, const Cpu *cpu, const Rom *rom, size_t index,
+        const DifferentialState *expected, bool verbose);
+static bool differential_same(const DifferentialState *a,
+        const DifferentialState *b);
+static void differential_print(const char *name,
+        const DifferentialState *state);
+
+// xorshift32, so every build generates the same programs.
+static uint32_t differential_random(uint32_t *state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int differential_below(uint32_t *state, int bound) {
+    return differential_random(state) % bound;
+}
+
+// Anything that doesn't change the flow or the stack by itself; those are
+// placed so they stay balanced. SED only on some seeds, so decimal mode
+// doesn't take over every program.
+static bool differential_plain(uint8_t opcode, bool decimal) {
+    const OpcodeInfo *info = &disasm_opcodes[opcode];
+    static const char *const excluded[] = {
+        "BRK", "JMP", "JSR", "RTS", "RTI", "PLP", "PLA", "PHA", "PHP",
+        "TXS", "SED", "CLI", "SEI"
+    };
+
+    if (!info->mnemonic || info->mode == MODE_RELATIVE) {
+        return false;
+    }
+    if (decimal && opcode == 0xf8) {
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(excluded) / sizeof(excluded[0]); i++) {
+        if (strcmp(info->mnemonic, excluded[i]) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What polling loops are made of, with a few that write so that not
+// every loop is idle.
+static bool differential_reader(uint8_t opcode, bool decimal) {
+    const OpcodeInfo *info = &disasm_opcodes[opcode];
+    static const char *const readers[] = {
+        "LDA", "LDX", "LDY", "CMP", "CPX", "CPY", "BIT", "AND", "ORA",
+        "EOR", "ADC", "SBC", "INX", "DEX", "TAX", "TAY", "NOP", "CLC",
+        "SEC", "ASL", "LSR", "PHA", "STA"
+    };
+
+    (void) decimal;
+    if (!info->mnemonic || info->mode == MODE_INDEXED_INDIRECT) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(readers) / sizeof(readers[0]); i++) {
+        if (strcmp(info->mnemonic, readers[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Absolute operands mostly land in zero page, the stack, the code's own
+// pages or the hotspot page, and on banked carts often right on a
+// hotspot.
+static size_t differential_instruction(byte *out, uint32_t *state,
+        bool decimal, bool banked, bool (*allowed)(uint8_t, bool)) {
+    static const uint8_t pages[] = { 0x00, 0x01, 0x02, 0x10, 0x1f, 0x20 };
+    uint8_t opcode;
+
+    do {
+        opcode = differential_random(state);
+    } while (!allowed(opcode, decimal));
+
+    const OpcodeInfo *info = &disasm_opcodes[opcode];
+    out[0] = opcode;
+    for (int i = 1; i < info->length; i++) {
+        out[i] = differential_random(state);
+    }
+    if (info->mode == MODE_ABSOLUTE || info->mode == MODE_ABSOLUTE_X
+            || info->mode == MODE_ABSOLUTE_Y) {
+        out[2] = pages[differential_below(state, sizeof(pages))];
+        if (banked && out[2] == 0x1f && differential_below(state, 2)) {
+            out[1] = 0xf6 + differential_below(state, 4);
+        }
+    }
+    return info->length;
+}
+
+// One 4K window laid out like a small program: the body from the start,
+// ending in a JMP back to it, then four subroutines it calls. A polling
+// loop whose branch holds spins until the run ends, so only some seeds get
+// them.
+static void differential_generate(byte *window, uint32_t *state,
+        bool decimal, bool banked, bool polls) {
+    size_t at = 0;
+
+    memset(window, 0xea, ROM_WINDOW_SIZE);
+    while (at < DIFFERENTIAL_BODY_END) {
+        int choice = differential_below(state, 100);
+
+        if (polls && choice < 4) {
+            // A loop polling memory until a branch falls through.
+            size_t start = at;
+
+            for (int i = differential_below(state, 3); i >= 0; i--) {
+                at += differential_instruction(window + at, state, decimal,
+                        banked, differential_reader);
+            }
+            window[at] = 0x10 + 0x20 * differential_below(state, 8);
+            window[at + 1] = (uint8_t) (start - (at + 2));
+            at += 2;
+        } else if (choice < 10) {
+            byte next[3];
+            size_t length = differential_instruction(next, state, decimal,
+                    banked, differential_plain);
+
+            window[at] = 0x10 + 0x20 * differential_below(state, 8);
+            window[at + 1] = length;
+            memcpy(window + at + 2, next, length);
+            at += 2 + length;
+        } else if (choice < 13) {
+            uint16_t target = ROM_START + DIFFERENTIAL_SUBROUTINES
+                + differential_below(state, 4) * DIFFERENTIAL_SUBROUTINE_SIZE;
+
+            window[at] = 0x20;
+            window[at + 1] = target & 0xff;
+            window[at + 2] = target >> 8;
+            at += 3;
+        } else if (choice < 15) {
+            window[at++] = 0x48;
+            window[at++] = 0x08;
+            at += differential_instruction(window + at, state, decimal,
+                    banked, differential_plain);
+            window[at++] = 0x28;
+            window[at++] = 0x68;
+        } else {
+            at += differential_instruction(window + at, state, decimal,
+                    banked, differential_plain);
+        }
+    }
+    window[at] = 0x4c;
+    window[at + 1] = ROM_START & 0xff;
+    window[at + 2] = ROM_START >> 8;
+
+    for (int k = 0; k < 4; k++) {
+        size_t start = DIFFERENTIAL_SUBROUTINES
+            + k * DIFFERENTIAL_SUBROUTINE_SIZE;
+        size_t end = start + DIFFERENTIAL_SUBROUTINE_SIZE - 4;
+
+        at = start;
+        while (at < end) {
+            byte next[3];
+            size_t length = differential_instruction(next, state, decimal,
+                    banked, differential_plain);
+
+            if (at + length > end) {
+                break;
+            }
+            memcpy(window + at, next, length);
+            at += length;
+        }
+        window[start + DIFFERENTIAL_SUBROUTINE_SIZE - 1] = 0x60;
+    }
+}
+
+// Banked programs go through a file, since rom_map maps carts from one.
+static int differential_build(DifferentialProgram *program, uint32_t seed) {
+    uint32_t state = seed * 2654435761u + 1;
+    bool decimal = seed & 1;
+    int banks = seed % 3 == 0 ? 1 : seed % 3 == 1 ? 2 : 4;
+
+    program->banked = banks > 1;
+    program->breakpoint = seed & 2;
+    program->size = banks * ROM_WINDOW_SIZE;
+    for (int i = 0; i < banks; i++) {
+        differential_generate(program->image + i * ROM_WINDOW_SIZE, &state,
+                decimal, program->banked, seed & 4);
+    }
+    if (!program->banked) {
+        return 0;
+    }
+
+    strcpy(program->path, "/tmp/differentialXXXXXX");
+    int fd = mkstemp(program->path);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, program->image, program->size)
+            != (ssize_t) program->size) {
+        close(fd);
+        unlink(program->path);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static void differential_ignore(Cpu *cpu, uint16_t pc,
+        const byte *instruction, void *context) {
+    (void) cpu;
+    (void) pc;
+    (void) instruction;
+    (void) context;
+}
+
+// A fresh Cpu at the start of the program, with its cart mapped through
+// rom if it has one.
+static Cpu *differential_load(const DifferentialProgram *program, Rom *rom) {
+    Cpu *cpu = malloc(sizeof(Cpu));
+
+    if (!cpu) {
+        return NULL;
+    }
+    cpu_initialize(cpu);
+    if (program->banked) {
+        if (rom_open(rom, program->path) < 0) {
+            free(cpu);
+            return NULL;
+        }
+        if (rom_map(rom, cpu) < 0) {
+            rom_close(rom);
+            free(cpu);
+            return NULL;
+        }
+    } else {
+        cpu_mapFlat(cpu);
+        memcpy(&cpu->memory[ROM_START], program->image, program->size);
+        cpu_flushBlocks(cpu);
+        cpu->pc = ROM_START;
+    }
+    if (program->breakpoint) {
+        cpu_setBreakpoint(cpu, DIFFERENTIAL_BREAKPOINT, true);
+    }
+    return cpu;
+}
+
+static void differential_unload(const DifferentialProgram *program,
+        Cpu *cpu, Rom *rom) {
+    cpu_releaseSnapshots(cpu);
+    if (program->banked) {
+        rom_close(rom);
+    }
+    cpu_release(cpu);
+    free(cpu);
+}
+
+// Everything but the counts, which only the caller knows.
+static void differential_capture(const DifferentialProgram *program,
+        const Cpu *cpu, const Rom *rom, DifferentialState *state) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < MAX_MEMORY; i++) {
+        hash = (hash ^ cpu->memory[i]) * 16777619u;
+    }
+    state->acc = cpu->acc;
+    state->x = cpu->x;
+    state->y = cpu->y;
+    state->status = cpu_getStatus(cpu);
+    state->sp = cpu->sp;
+    state->pc = cpu->pc;
+    state->cycles = cpu->cycles;
+    state->memory = hash;
+    state->bank = program->banked ? rom->bank : 0;
+}
+
+static int differential_run(const DifferentialProgram *program,
+        DifferentialMode mode, uint64_t instructions,
+        DifferentialState *state) {
+    CpuSnapshot *snapshot = NULL;
+    Rom rom;
+    Cpu *cpu = differential_load(program, &rom);
+    unsigned slice = 1;
+    bool released = false;
+
+    if (!cpu) {
+        return -1;
+    }
+    if (mode == DIFFERENTIAL_STEP) {
+        cpu_setTraceHook(cpu, differential_ignore, NULL);
+    }
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+    cpu_setJit(cpu, mode == DIFFERENTIAL_JIT);
+#endif
+
+    state->executed = 0;
+    state->stops = 0;
+    while (state->executed < instructions
+            && state->stops < DIFFERENTIAL_MAX_STOPS) {
+        CpuStopReason stop;
+
+        state->executed += cpu_run(cpu, slice,
+                slice % 3 ? CPU_RUN_UNLIMITED : slice * 3, &stop);
+        if (stop == CPU_STOP_BRK || stop == CPU_STOP_ILLEGAL) {
+            state->stops++;
+            cpu->pc = ROM_START;
+        }
+        slice = (slice * 7 + 3) % 5000 + 1;
+
+        // A released Cpu carries on, compiling into a new code space.
+        if (!released && state->executed > instructions / 4) {
+            cpu_release(cpu);
+            released = true;
+        }
+
+        // Run on a little, then go back: the restore has to leave the
+        // caches agreeing with memory and the bank.
+        if (!snapshot && state->executed > instructions / 2) {
+            CpuSnapshot *taken = cpu_snapshot(cpu);
+
+            if (taken) {
+                cpu_run(cpu, 5000, CPU_RUN_UNLIMITED, &stop);
+                cpu_restore(cpu, taken);
+                snapshot = taken;
+            }
+        }
+    }
+
+    differential_capture(program, cpu, &rom, state);
+    cpu_freeSnapshot(snapshot);
+    differential_unload(program, cpu, &rom);
+    return 0;
+}
+
+// Runs the program twice side by side in DIFFERENTIAL_POINTS slices, one
+// of them recording a rewind point after each slice, and keeps the state
+// of the other at each point. The recorded run then has to land on those
+// states seeking back to the oldest point still held, forward to the
+// newest and across in jumps, and after going back halfway, to retrace
+// them running on. Returns how many landings differed, or -1.
+static int differential_rewind(const DifferentialProgram *program,
+        size_t budget, uint64_t instructions, bool verbose) {
+    DifferentialState states[DIFFERENTIAL_POINTS + 1];
+    // Points are recorded before the restart after BRK or an illegal
+    // opcode, so running on from one has to restart as well.
+    bool restarted[DIFFERENTIAL_POINTS + 1] = { false };
+    uint64_t interval = instructions / DIFFERENTIAL_POINTS + 1;
+    Rom straightRom;
+    Rom rewoundRom;
+    Cpu *straight = differential_load(program, &straightRom);
+    Cpu *rewound = differential_load(program, &rewoundRom);
+    RewindBuffer *rewind = rewound ? rewind_create(rewound, budget) : NULL;
+    int failed = 0;
+
+    if (!straight || !rewind) {
+        failed = -1;
+        goto done;
+    }
+
+    memset(states, 0, sizeof(states));
+    differential_capture(program, straight, &straightRom, &states[0]);
+    for (int point = 1; point <= DIFFERENTIAL_POINTS; point++) {
+        CpuStopReason stop;
+        CpuStopReason rewoundStop;
+
+        cpu_run(straight, interval, CPU_RUN_UNLIMITED, &stop);
+        differential_capture(program, straight, &straightRom,
+                &states[point]);
+        if (rewind_run(rewind, interval, interval, NULL, &rewoundStop) < 0) {
+            printf("  recording point %d failed\n", point);
+            failed = 1;
+            goto done;
+        }
+        if (stop == CPU_STOP_BRK || stop == CPU_STOP_ILLEGAL) {
+            straight->pc = ROM_START;
+            restarted[point] = true;
+        }
+        if (rewoundStop == CPU_STOP_BRK || rewoundStop == CPU_STOP_ILLEGAL) {
+            rewound->pc = ROM_START;
+        }
+    }
+
+    size_t count = rewind_count(rewind);
+    size_t oldest = DIFFERENTIAL_POINTS + 1 - count;
+
+    for (size_t i = count; i-- > 0;) {
+        failed += differential_seek(program, rewind, rewound, &rewoundRom, i,
+                &states[oldest + i], verbose);
+    }
+    for (size_t i = 1; i < count; i++) {
+        failed += differential_seek(program, rewind, rewound, &rewoundRom, i,
+                &states[oldest + i], verbose);
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t index = i * 7 % count;
+
+        failed += differential_seek(program, rewind, rewound, &rewoundRom,
+                index, &states[oldest + index], verbose);
+    }
+
+    // Recording from the middle forgets the points after it, and the ones
+    // recorded in their place have to come out the same.
+    size_t middle = count / 2;
+
+    failed += differential_seek(program, rewind, rewound, &rewoundRom,
+            middle, &states[oldest + middle], verbose);
+    if (restarted[oldest + middle]) {
+        rewound->pc = ROM_START;
+    }
+    for (size_t point = oldest + middle + 1; point <= DIFFERENTIAL_POINTS;
+            point++) {
+        DifferentialState state;
+        CpuStopReason stop;
+
+        if (rewind_run(rewind, interval, interval, NULL, &stop) < 0) {
+            printf("  recording point %zu again failed\n", point);
+            failed++;
+            break;
+        }
+        memset(&state, 0, sizeof(state));
+        differential_capture(program, rewound, &rewoundRom, &state);
+        if (!differential_same(&state, &states[point])) {
+            if (verbose) {
+                printf("  running on to point %zu:\n", point);
+                differential_print("want", &states[point]);
+                differential_print("got", &state);
+            }
+            failed++;
+        }
+        if (stop == CPU_STOP_BRK || stop == CPU_STOP_ILLEGAL) {
+            rewound->pc = ROM_START;
+        }
+    }
+    failed += differential_seek(program, rewind, rewound, &rewoundRom, 0,
+            &states[oldest], verbose);
+
+done:
+    rewind_free(rewind);
+    if (straight) {
+        differential_unload(program, straight, &straightRom);
+    }
+    if (rewound) {
+        differential_unload(program, rewound, &rewoundRom);
+    }
+    return failed;
+}
+
+// Seeks to point index and returns 1 if the Cpu doesn't match expected.
+static int differential_seek(const DifferentialProgram *program,
+        RewindBuffer *rewind, const Cpu *cpu, const Rom *rom, size_t index,
+        const DifferentialState *expected, bool verbose) {
+    DifferentialState state;
+
+    memset(&state, 0, sizeof(state));
+    if (rewind_seek(rewind, index) < 0) {
+        if (verbose) {
+            printf("  seeking to point %zu failed\n", index);
+        }
+        return 1;
+    }
+    differential_capture(program, cpu, rom, &state);
+    if (differential_same(&state, expected)) {
+        return 0;
+    }
+    if (verbose) {
+        printf("  seeking to point %zu:\n", index);
+        differential_print("want", expected);
+        differential_print("got", &state);
+    }
+    return 1;
+}
+
+static bool differential_same(const DifferentialState *a,
+        const DifferentialState *b) {
+    return a->executed == b->executed && a->stops == b->stops
+        && a->acc == b->acc && a->x == b->x && a->y == b->y
+        && a->status == b->status && a->sp == b->sp && a->pc == b->pc
+        && a->cycles == b->cycles && a->memory == b->memory
+        && a->bank == b->bank;
+}
+
+static void differential_print(const char *name,
+        const DifferentialState *state) {
+    printf("  %-4s executed=%llu stops=%d A=%02x X=%02x Y=%02x P=%02x "
+            "SP=%04x PC=%04x cycles=%llu memory=%08x bank=%d\n", name,
+            (unsigned long long) state->executed, state->stops, state->acc,
+            state->x, state->y, state->status, state->sp, state->pc,
+            (unsigned long long) state->cycles, state->memory, state->bank);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t first = 1;
+    uint32_t seeds = DIFFERENTIAL_SEEDS;
+    uint64_t instructions = DIFFERENTIAL_INSTRUCTIONS;
+    bool verbose = false;
+    int mismatches = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            first = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seeds = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            instructions = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-f first] [-s seeds] "
+                    "[-n instructions] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    DifferentialProgram *program = malloc(sizeof(DifferentialProgram));
+    if (!program) {
+        perror("differential");
+        return 1;
+    }
+
+    for (uint32_t seed = first; seed < first + seeds; seed++) {
+        DifferentialState states[DIFFERENTIAL_MODES];
+        bool same = true;
+
+        if (differential_build(program, seed) < 0) {
+            perror("differential");
+            return 1;
+        }
+        for (int mode = 0; mode < DIFFERENTIAL_MODES; mode++) {
+            if (differential_run(program, mode, instructions,
+                    &states[mode]) < 0) {
+                perror("differential");
+                return 1;
+            }
+            same = same && differential_same(&states[mode], &states[0]);
+        }
+        for (size_t i = 0; i < sizeof(differential_budgets)
+                / sizeof(differential_budgets[0]); i++) {
+            int failed = differential_rewind(program, differential_budgets[i],
+                    instructions, verbose);
+
+            if (failed < 0) {
+                perror("differential");
+                return 1;
+            }
+            if (failed || verbose) {
+                printf("  rewind in %zuK: %d landings differed\n",
+                        differential_budgets[i] >> 10, failed);
+            }
+            same = same && failed == 0;
+        }
+        if (program->banked) {
+            unlink(program->path);
+        }
+
+        if (!same) {
+            mismatches++;
+        }
+        if (!same || verbose) {
+            printf("seed %u (%s): %s\n", seed, program->banked
+                    ? (program->size == 2 * ROM_WINDOW_SIZE ? "F8" : "F6")
+                    : "flat", same ? "ok" : "MISMATCH");
+            for (int mode = 0; mode < DIFFERENTIAL_MODES; mode++) {
+                differential_print(differential_modeNames[mode],
+                        &states[mode]);
+            }
+        }
+    }
+
+    printf("%u seeds, %d mismatched\n", seeds, mismatches);
+    free(program);
+
+    return mismatches ? 1 : 0;
+}
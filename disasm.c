@@ -0,0 +1,244 @@
+#include <string.h>
+
+#include "disasm.h"
+
+// ABSOLUTE through INDIRECT take a 16-bit operand.
+#define DISASM_LENGTH(mode) \
+    ((mode) == MODE_IMPLIED || (mode) == MODE_ACCUMULATOR ? 1 \
+     : (mode) >= MODE_ABSOLUTE && (mode) <= MODE_INDIRECT ? 3 : 2)
+
+#define DISASM_INFO(op, name, mnemonic, mode, cycles) \
+    [op] = { mnemonic, MODE_##mode, DISASM_LENGTH(MODE_##mode), cycles },
+const OpcodeInfo disasm_opcodes[256] = {
+    CPU_OPCODES(DISASM_INFO)
+};
+#undef DISASM_INFO
+
+// Two hex digits per byte value, so a byte is formatted with one copy.
+static const char disasm_hexPairs[512] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static inline char *disasm_hex(char *text, unsigned value, int digits);
+static inline char *disasm_string(char *text, const char *string);
+static char *disasm_line(const byte *buffer, size_t length,
+        uint16_t address, char *text, size_t *consumed);
+static inline char *disasm_fastLine(const byte *buffer, uint16_t address,
+        char *text, size_t *consumed);
+
+static inline char *disasm_hex(char *text, unsigned value, int digits) {
+    if (digits == 4) {
+        memcpy(text, &disasm_hexPairs[(value >> 8 & 0xff) * 2], 2);
+        text += 2;
+    }
+    memcpy(text, &disasm_hexPairs[(value & 0xff) * 2], 2);
+    return text + 2;
+}
+
+static inline char *disasm_string(char *text, const char *string) {
+    while (*string) {
+        *text++ = *string++;
+    }
+    return text;
+}
+
+size_t disasm_decode(const byte *buffer, size_t length, uint16_t address,
+        DisasmInstruction *instruction) {
+    const OpcodeInfo *info = &disasm_opcodes[buffer[0]];
+
+    instruction->address = address;
+    instruction->opcode = buffer[0];
+    instruction->operand = 0;
+    instruction->length = info->length;
+
+    if (!info->mnemonic || info->length > length) {
+        instruction->length = 1;
+    } else if (info->length == 2) {
+        instruction->operand = buffer[1];
+    } else if (info->length == 3) {
+        instruction->operand = buffer[1] | (buffer[2] << 8);
+    }
+
+    return instruction->length;
+}
+
+size_t disasm_format(const DisasmInstruction *instruction, char *text) {
+    const OpcodeInfo *info = &disasm_opcodes[instruction->opcode];
+    char *p = text;
+
+    if (!info->mnemonic || instruction->length != info->length) {
+        p = disasm_hex(disasm_string(p, ".byte $"), instruction->opcode, 2);
+        *p = '\0';
+        return p - text;
+    }
+
+    // Every mnemonic is three letters.
+    memcpy(p, info->mnemonic, 3);
+    p += 3;
+    switch (info->mode) {
+        case MODE_IMPLIED:
+            break;
+        case MODE_ACCUMULATOR:
+            p = disasm_string(p, " A");
+            break;
+        case MODE_IMMEDIATE:
+            p = disasm_hex(disasm_string(p, " #$"), instruction->operand, 2);
+            break;
+        case MODE_ZERO_PAGE:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 2);
+            break;
+        case MODE_ZERO_PAGE_X:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 2);
+            p = disasm_string(p, ",X");
+            break;
+        case MODE_ZERO_PAGE_Y:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 2);
+            p = disasm_string(p, ",Y");
+            break;
+        case MODE_ABSOLUTE:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 4);
+            break;
+        case MODE_ABSOLUTE_X:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 4);
+            p = disasm_string(p, ",X");
+            break;
+        case MODE_ABSOLUTE_Y:
+            p = disasm_hex(disasm_string(p, " $"), instruction->operand, 4);
+            p = disasm_string(p, ",Y");
+            break;
+        case MODE_INDIRECT:
+            p = disasm_hex(disasm_string(p, " ($"), instruction->operand, 4);
+            p = disasm_string(p, ")");
+            break;
+        case MODE_INDEXED_INDIRECT:
+            p = disasm_hex(disasm_string(p, " ($"), instruction->operand, 2);
+            p = disasm_string(p, ",X)");
+            break;
+        case MODE_INDIRECT_INDEXED:
+            p = disasm_hex(disasm_string(p, " ($"), instruction->operand, 2);
+            p = disasm_string(p, "),Y");
+            break;
+        case MODE_RELATIVE: {
+            // Shown as the branch target rather than the raw offset.
+            uint16_t target = instruction->address + 2
+                + (int8_t) instruction->operand;
+            p = disasm_hex(disasm_string(p, " $"), target, 4);
+            break;
+        }
+    }
+
+    *p = '\0';
+    return p - text;
+}
+
+// Text after the mnemonic for each mode, with the positions its high and
+// low operand digits go. Modes with fewer digits aim the unused ones past
+// the end of the text, where the next line overwrites them.
+typedef struct _disasmTemplate {
+    char text[12];
+    uint8_t length;
+    uint8_t high;
+    uint8_t low;
+} DisasmTemplate;
+
+static const DisasmTemplate disasm_templates[] = {
+    [MODE_IMPLIED] = { "", 0, 10, 10 },
+    [MODE_ACCUMULATOR] = { " A", 2, 10, 10 },
+    [MODE_IMMEDIATE] = { " #$", 5, 10, 3 },
+    [MODE_ZERO_PAGE] = { " $", 4, 10, 2 },
+    [MODE_ZERO_PAGE_X] = { " $  ,X", 6, 10, 2 },
+    [MODE_ZERO_PAGE_Y] = { " $  ,Y", 6, 10, 2 },
+    [MODE_ABSOLUTE] = { " $", 6, 2, 4 },
+    [MODE_ABSOLUTE_X] = { " $    ,X", 8, 2, 4 },
+    [MODE_ABSOLUTE_Y] = { " $    ,Y", 8, 2, 4 },
+    [MODE_INDIRECT] = { " ($    )", 8, 3, 5 },
+    [MODE_INDEXED_INDIRECT] = { " ($  ,X)", 8, 10, 3 },
+    [MODE_INDIRECT_INDEXED] = { " ($  ),Y", 8, 10, 3 },
+    [MODE_RELATIVE] = { " $", 6, 2, 4 },
+};
+
+// The general case: any opcode, and instructions cut off by the end of the
+// buffer.
+static char *disasm_line(const byte *buffer, size_t length,
+        uint16_t address, char *text, size_t *consumed) {
+    DisasmInstruction instruction;
+    char *p = text;
+
+    *consumed = disasm_decode(buffer, length, address, &instruction);
+    p = disasm_hex(p, address, 4);
+    p = disasm_string(p, "  ");
+    for (size_t i = 0; i < 3; i++) {
+        if (i < *consumed) {
+            p = disasm_hex(p, buffer[i], 2);
+            *p++ = ' ';
+        } else {
+            p = disasm_string(p, "   ");
+        }
+    }
+    *p++ = ' ';
+    p += disasm_format(&instruction, p);
+    *p++ = '\n';
+
+    return p;
+}
+
+// Same output as disasm_line for a known opcode with all three bytes
+// readable, built from fixed-size copies so there is next to nothing to
+// mispredict.
+static inline char *disasm_fastLine(const byte *buffer, uint16_t address,
+        char *text, size_t *consumed) {
+    const OpcodeInfo *info = &disasm_opcodes[buffer[0]];
+    const DisasmTemplate *template = &disasm_templates[info->mode];
+    uint16_t operand = buffer[1] | (buffer[2] << 8);
+    uint16_t target = address + 2 + (int8_t) buffer[1];
+    uint16_t value = info->mode == MODE_RELATIVE ? target : operand;
+    char *p = text;
+
+    p = disasm_hex(p, address, 4);
+    memcpy(p, "  ", 2);
+    p += 2;
+    for (int i = 0; i < 3; i++) {
+        memcpy(p + i * 3, &disasm_hexPairs[buffer[i] * 2], 2);
+        p[i * 3 + 2] = ' ';
+    }
+    memcpy(p + info->length * 3, "          ", 10);
+    p += 10;
+
+    memcpy(p, info->mnemonic, 3);
+    memcpy(p + 3, template->text, sizeof(template->text));
+    memcpy(p + 3 + template->high, &disasm_hexPairs[(value >> 8) * 2], 2);
+    memcpy(p + 3 + template->low, &disasm_hexPairs[(value & 0xff) * 2], 2);
+    p += 3 + template->length;
+    *p++ = '\n';
+
+    *consumed = info->length;
+    return p;
+}
+
+size_t disasm(const byte *buffer, size_t length, uint16_t origin, char *out,
+        size_t size, size_t *written) {
+    size_t offset = 0;
+    char *p = out;
+
+    while (offset < length && (size_t) (p - out) + DISASM_LINE_SIZE <= size) {
+        size_t consumed;
+
+        if (offset + 3 <= length && disasm_opcodes[buffer[offset]].mnemonic) {
+            p = disasm_fastLine(buffer + offset, origin + offset, p,
+                    &consumed);
+        } else {
+            p = disasm_line(buffer + offset, length - offset,
+                    origin + offset, p, &consumed);
+        }
+        offset += consumed;
+    }
+
+    *written = p - out;
+    return offset;
+}
@@ -0,0 +1,47 @@
+#ifndef DISASM_H_INCLUDED_
+#define DISASM_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "opcodes.h"
+
+// Room for the longest instruction text, "STA ($12),Y", or for ".byte $xx",
+// plus the terminator.
+#define DISASM_TEXT_SIZE 16
+// Address, up to three bytes of hex, the instruction text and a newline.
+#define DISASM_LINE_SIZE (6 + 9 + 1 + DISASM_TEXT_SIZE)
+
+typedef struct _opcodeInfo {
+    const char *mnemonic;
+    AddressMode mode;
+    uint8_t length;
+    uint8_t cycles;
+} OpcodeInfo;
+
+// Indexed by opcode and generated from CPU_OPCODES. Opcodes the CPU
+// doesn't implement have a NULL mnemonic and a length of 1.
+extern const OpcodeInfo disasm_opcodes[256];
+
+typedef struct _disasmInstruction {
+    uint16_t address;
+    uint8_t opcode;
+    uint16_t operand;
+    uint8_t length;
+} DisasmInstruction;
+
+// Decodes the instruction at the start of buffer, which sits at address.
+// Unknown opcodes, and instructions cut off by the end of the buffer, come
+// back as a single data byte. Returns the number of bytes consumed.
+size_t disasm_decode(const byte *buffer, size_t length, uint16_t address,
+        DisasmInstruction *instruction);
+// Writes the instruction as text, e.g. "LDA $80,X", and returns its length.
+size_t disasm_format(const DisasmInstruction *instruction, char *text);
+// Lists as many whole instructions from buffer as fit in out, one per line
+// as "1000  a9 05     LDA #$05". Returns the number of bytes of buffer
+// consumed and sets *written to the number of characters produced.
+size_t disasm(const byte *buffer, size_t length, uint16_t origin, char *out,
+        size_t size, size_t *written);
+
+#endif /* DISASM_H_INCLUDED_ */
@@ -0,0 +1,84 @@
+/*
+ * Disassembles a ROM image in one pass.
+ *
+ *   cc -O2 -o disassemble disassemble.c disasm.c
+ *   ./disassemble [-o origin] [-q] rom
+ *
+ * The listing starts at origin ($1000 unless given). -q skips writing it
+ * and reports the decoding speed on stderr instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "disasm.h"
+
+#define DISASSEMBLE_OUTPUT_SIZE (1 << 20)
+
+static double disassemble_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    uint16_t origin = ROM_START;
+    bool quiet = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            origin = strtoul(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [-o origin] [-q] rom\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    byte *buffer = malloc(sz > 0 ? sz : 1);
+    if (fread(buffer, 1, sz, f) != (size_t) sz) {
+        perror(path);
+        return 1;
+    }
+    fclose(f);
+
+    char *out = malloc(DISASSEMBLE_OUTPUT_SIZE);
+    double start = disassemble_now();
+    size_t offset = 0;
+
+    while (offset < (size_t) sz) {
+        size_t written;
+
+        offset += disasm(buffer + offset, sz - offset, origin + offset, out,
+                DISASSEMBLE_OUTPUT_SIZE, &written);
+        if (!quiet) {
+            fwrite(out, 1, written, stdout);
+        }
+    }
+
+    if (quiet) {
+        double elapsed = disassemble_now() - start;
+        fprintf(stderr, "%ld bytes in %.3f s, %.1f MB/s\n", sz, elapsed,
+                sz / elapsed / 1e6);
+    }
+
+    free(out);
+    free(buffer);
+
+    return 0;
+}
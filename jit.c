@@ -0,0 +1,742 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "disasm.h"
+#include "jit.h"
+
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+
+// Code space of each Cpu, and the most one block can take: the largest
+// instruction, a store with a handler call to fall back on, is under 128
+// bytes. A full cache of blocks that size would take 2MB.
+#define JIT_CODE_SPACE (8 << 20)
+#define JIT_BLOCK_SPACE 4096
+// Blocks start this far in, after the enter stub, and on this alignment.
+#define JIT_ENTER_SPACE 64
+#define JIT_ALIGN 16
+
+// Host registers by number. rbx holds the Cpu; A, X and Y are kept
+// zero-extended in r12-r14 while a block runs and are written back to the
+// Cpu before every exit and handler call if they changed. r15 is only
+// saved to keep the stack aligned for calls.
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RBX 3
+#define JIT_RDI 7
+#define JIT_R12 12
+#define JIT_R13 13
+#define JIT_R14 14
+
+// Instruction prefixes: a 64-bit operand (REX.W) or a 16-bit one (0x66).
+#define JIT_WIDE 1
+#define JIT_WORD 2
+
+// x86 condition codes, as in jcc and setcc.
+#define JIT_BELOW 0x2
+#define JIT_ABOVE_EQUAL 0x3
+#define JIT_EQUAL 0x4
+#define JIT_NOT_EQUAL 0x5
+#define JIT_BELOW_EQUAL 0x6
+#define JIT_ABOVE 0x7
+#define JIT_ALWAYS -1
+
+#define JIT_FIELD(field) ((int32_t) offsetof(Cpu, field))
+
+// A block being compiled. Code is assembled here and copied into the code
+// space once its size is known, so it mustn't use absolute addresses of
+// itself; jumps to the shared leave sequence at its end are patched in
+// once that is placed.
+typedef struct _jitBuffer {
+    uint8_t code[JIT_BLOCK_SPACE];
+    size_t size;
+    size_t leaves[4 * CPU_BLOCK_MAX + 8];
+    int leaveCount;
+    bool overflow;
+    // Base cycles of inlined instructions not yet added to Cpu.cycles.
+    uint32_t pendingCycles;
+    // Which of A, X and Y (bit 0-2) the host registers hold, and which of
+    // those are newer than the Cpu's copy. Registers are loaded on first
+    // use and written back only when changed.
+    uint8_t loaded;
+    uint8_t dirty;
+} JitBuffer;
+
+static uint8_t *jit_codeSpace(Cpu *cpu);
+static void jit_reclaim(Cpu *cpu);
+static void jit_byte(JitBuffer *b, uint8_t value);
+static void jit_bytes(JitBuffer *b, uint64_t value, int count);
+static void jit_instruction(JitBuffer *b, int prefix, uint16_t opcode,
+        int reg, int rm);
+static void jit_memory(JitBuffer *b, int prefix, uint16_t opcode, int reg,
+        int base, int32_t disp);
+static void jit_register(JitBuffer *b, int prefix, uint16_t opcode, int reg,
+        int rm);
+static void jit_moveImmediate(JitBuffer *b, int reg, uint64_t value);
+static size_t jit_jump(JitBuffer *b, int condition);
+static void jit_land(JitBuffer *b, size_t jump);
+static void jit_leave(JitBuffer *b, int condition);
+static void jit_setZN(JitBuffer *b, int reg);
+static int32_t jit_registerField(int reg);
+static void jit_use(JitBuffer *b, int reg);
+static void jit_define(JitBuffer *b, int reg);
+static void jit_reload(JitBuffer *b, uint8_t registers);
+static void jit_spill(JitBuffer *b);
+static void jit_flushCycles(JitBuffer *b);
+static void jit_chain(JitBuffer *b, int base, int32_t slot);
+static void jit_exit(JitBuffer *b, uint16_t target);
+static void jit_exitDynamic(JitBuffer *b);
+static void jit_call(JitBuffer *b, const CpuBlock *block, int index,
+        uint16_t pc);
+static bool jit_branch(JitBuffer *b, uint8_t opcode, uint16_t pc,
+        uint8_t offset);
+static bool jit_inline(JitBuffer *b, Cpu *cpu, const CpuBlock *block,
+        int index, uint16_t pc);
+static int jit_registerOf(uint8_t opcode);
+
+// The enter stub, at the start of the code space: saves the registers
+// blocks use, takes the Cpu from rdi and jumps to the block in rsi.
+static const uint8_t jit_enter[] = {
+    0x53,                   // push rbx
+    0x41, 0x54,             // push r12
+    0x41, 0x55,             // push r13
+    0x41, 0x56,             // push r14
+    0x41, 0x57,             // push r15
+    0x48, 0x89, 0xfb,       // mov rbx, rdi
+    0xff, 0xe6,             // jmp rsi
+};
+
+// What every block ends with and leaves through.
+static const uint8_t jit_return[] = {
+    0x41, 0x5f,             // pop r15
+    0x41, 0x5e,             // pop r14
+    0x41, 0x5d,             // pop r13
+    0x41, 0x5c,             // pop r12
+    0x5b,                   // pop rbx
+    0xc3,                   // ret
+};
+
+// Maps the Cpu's code space the first time it compiles a block. It is
+// never writable and executable at once: pages are opened for writing
+// only while a block is copied in.
+static uint8_t *jit_codeSpace(Cpu *cpu) {
+    uint8_t *space = cpu->jitCode;
+
+    if (space) {
+        return space;
+    }
+    space = mmap(NULL, JIT_CODE_SPACE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (space == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(space, jit_enter, sizeof(jit_enter));
+    if (mprotect(space, JIT_CODE_SPACE, PROT_READ | PROT_EXEC) < 0) {
+        munmap(space, JIT_CODE_SPACE);
+        return NULL;
+    }
+    cpu->jitCode = space;
+    cpu->jitUsed = 0;
+    return space;
+}
+
+// Exits look up the next block's code as they run, so once no block
+// points into the space it can all be reused. The blocks stay cached and
+// start counting towards the threshold again.
+static void jit_reclaim(Cpu *cpu) {
+    for (int i = 0; i < CPU_BLOCK_CACHE_SIZE; i++) {
+        cpu->blocks[i].native = NULL;
+        cpu->blocks[i].entries = 0;
+    }
+    cpu->jitUsed = 0;
+}
+
+static void jit_byte(JitBuffer *b, uint8_t value) {
+    if (b->size < JIT_BLOCK_SPACE) {
+        b->code[b->size++] = value;
+    } else {
+        b->overflow = true;
+    }
+}
+
+// Little-endian, as immediates and displacements are.
+static void jit_bytes(JitBuffer *b, uint64_t value, int count) {
+    for (int i = 0; i < count; i++) {
+        jit_byte(b, value >> (8 * i));
+    }
+}
+
+// Prefixes, REX if any register is r8-r15 or the operand is 64-bit, and
+// the one or two opcode bytes.
+static void jit_instruction(JitBuffer *b, int prefix, uint16_t opcode,
+        int reg, int rm) {
+    uint8_t rex = 0x40 | ((prefix & JIT_WIDE) ? 8 : 0) | (reg >= 8 ? 4 : 0)
+        | (rm >= 8 ? 1 : 0);
+
+    if (prefix & JIT_WORD) {
+        jit_byte(b, 0x66);
+    }
+    if (rex != 0x40) {
+        jit_byte(b, rex);
+    }
+    if (opcode > 0xff) {
+        jit_byte(b, opcode >> 8);
+    }
+    jit_byte(b, opcode & 0xff);
+}
+
+// opcode reg, [base + disp]. base is never rsp or rbp, so no SIB byte.
+static void jit_memory(JitBuffer *b, int prefix, uint16_t opcode, int reg,
+        int base, int32_t disp) {
+    jit_instruction(b, prefix, opcode, reg, base);
+    jit_byte(b, 0x80 | (reg & 7) << 3 | (base & 7));
+    jit_bytes(b, (uint32_t) disp, 4);
+}
+
+// opcode rm, reg; reg is the opcode extension for group instructions.
+static void jit_register(JitBuffer *b, int prefix, uint16_t opcode, int reg,
+        int rm) {
+    jit_instruction(b, prefix, opcode, reg, rm);
+    jit_byte(b, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void jit_moveImmediate(JitBuffer *b, int reg, uint64_t value) {
+    if (value > 0xffffffff) {
+        jit_instruction(b, JIT_WIDE, 0xb8 + (reg & 7), 0, reg);
+        jit_bytes(b, value, 8);
+    } else {
+        jit_instruction(b, 0, 0xb8 + (reg & 7), 0, reg);
+        jit_bytes(b, value, 4);
+    }
+}
+
+// A forward jump, taken on condition, to be pointed at a later spot with
+// jit_land.
+static size_t jit_jump(JitBuffer *b, int condition) {
+    if (condition == JIT_ALWAYS) {
+        jit_byte(b, 0xe9);
+    } else {
+        jit_byte(b, 0x0f);
+        jit_byte(b, 0x80 | condition);
+    }
+    jit_bytes(b, 0, 4);
+    return b->size;
+}
+
+static void jit_land(JitBuffer *b, size_t jump) {
+    if (!b->overflow) {
+        uint32_t distance = b->size - jump;
+        memcpy(&b->code[jump - 4], &distance, 4);
+    }
+}
+
+static void jit_leave(JitBuffer *b, int condition) {
+    size_t jump = jit_jump(b, condition);
+
+    if (b->leaveCount < (int) (sizeof(b->leaves) / sizeof(b->leaves[0]))) {
+        b->leaves[b->leaveCount++] = jump;
+    } else {
+        b->overflow = true;
+    }
+}
+
+static void jit_setZN(JitBuffer *b, int reg) {
+    jit_memory(b, 0, 0x88, reg, JIT_RBX, JIT_FIELD(flagN));
+    jit_memory(b, 0, 0x88, reg, JIT_RBX, JIT_FIELD(flagZ));
+}
+
+static int32_t jit_registerField(int reg) {
+    switch (reg) {
+        case JIT_R12:
+            return JIT_FIELD(acc);
+        case JIT_R13:
+            return JIT_FIELD(x);
+        default:
+            return JIT_FIELD(y);
+    }
+}
+
+// Before reading reg.
+static void jit_use(JitBuffer *b, int reg) {
+    uint8_t bit = 1 << (reg - JIT_R12);
+
+    if (!(b->loaded & bit)) {
+        jit_memory(b, 0, 0x0fb6, reg, JIT_RBX, jit_registerField(reg));
+        b->loaded |= bit;
+    }
+}
+
+// Before writing all of reg.
+static void jit_define(JitBuffer *b, int reg) {
+    uint8_t bit = 1 << (reg - JIT_R12);
+
+    b->loaded |= bit;
+    b->dirty |= bit;
+}
+
+static void jit_reload(JitBuffer *b, uint8_t registers) {
+    b->loaded = 0;
+    for (int reg = JIT_R12; reg <= JIT_R14; reg++) {
+        if (registers & 1 << (reg - JIT_R12)) {
+            jit_use(b, reg);
+        }
+    }
+}
+
+static void jit_spill(JitBuffer *b) {
+    for (int reg = JIT_R12; reg <= JIT_R14; reg++) {
+        if (b->dirty & 1 << (reg - JIT_R12)) {
+            jit_memory(b, 0, 0x88, reg, JIT_RBX, jit_registerField(reg));
+        }
+    }
+    b->dirty = 0;
+}
+
+static void jit_flushCycles(JitBuffer *b) {
+    if (b->pendingCycles > 0) {
+        jit_memory(b, JIT_WIDE, 0x81, 0, JIT_RBX, JIT_FIELD(cycles));
+        jit_bytes(b, b->pendingCycles, 4);
+        b->pendingCycles = 0;
+    }
+}
+
+// Jumps to the code of the block at [base + slot] if it starts at dx and
+// is still valid and compiled, and leaves otherwise. The Cpu is up to date
+// by then. base is the Cpu for a slot known when compiling, or the block
+// itself.
+static void jit_chain(JitBuffer *b, int base, int32_t slot) {
+    jit_memory(b, JIT_WORD, 0x39, JIT_RDX, base,
+            slot + offsetof(CpuBlock, start));
+    jit_leave(b, JIT_NOT_EQUAL);
+    jit_memory(b, 0, 0x80, 7, base, slot + offsetof(CpuBlock, valid));
+    jit_byte(b, 0);
+    jit_leave(b, JIT_EQUAL);
+    jit_memory(b, JIT_WIDE, 0x8b, JIT_RAX, base,
+            slot + offsetof(CpuBlock, native));
+    jit_register(b, JIT_WIDE, 0x85, JIT_RAX, JIT_RAX);
+    jit_leave(b, JIT_EQUAL);
+    jit_register(b, 0, 0xff, 4, JIT_RAX);
+}
+
+// Leaves the block for target, a constant, chaining to its block if it
+// has compiled code.
+static void jit_exit(JitBuffer *b, uint16_t target) {
+    jit_spill(b);
+    jit_flushCycles(b);
+    jit_memory(b, JIT_WORD, 0xc7, 0, JIT_RBX, JIT_FIELD(pc));
+    jit_bytes(b, target, 2);
+    jit_moveImmediate(b, JIT_RDX, target);
+    jit_chain(b, JIT_RBX, JIT_FIELD(blocks)
+            + CPU_BLOCK_SLOT(target) * (int32_t) sizeof(CpuBlock));
+}
+
+// Leaves the block for wherever a handler left pc, with the Cpu already
+// up to date, finding the next block's slot at run time.
+static void jit_exitDynamic(JitBuffer *b) {
+    jit_memory(b, 0, 0x0fb7, JIT_RDX, JIT_RBX, JIT_FIELD(pc));
+    jit_register(b, 0, 0x89, JIT_RDX, JIT_RCX);
+    jit_register(b, 0, 0xc1, 5, JIT_RCX);
+    jit_byte(b, 10);
+    jit_register(b, 0, 0x31, JIT_RDX, JIT_RCX);
+    jit_register(b, 0, 0x81, 4, JIT_RCX);
+    jit_bytes(b, CPU_BLOCK_CACHE_SIZE - 1, 4);
+    jit_register(b, JIT_WIDE, 0x69, JIT_RCX, JIT_RCX);
+    jit_bytes(b, sizeof(CpuBlock), 4);
+    // lea rax, [rbx + rcx + blocks]
+    jit_byte(b, 0x48);
+    jit_byte(b, 0x8d);
+    jit_byte(b, 0x84);
+    jit_byte(b, JIT_RCX << 3 | JIT_RBX);
+    jit_bytes(b, JIT_FIELD(blocks), 4);
+    jit_chain(b, JIT_RAX, 0);
+}
+
+// Runs instruction index through its handler like cpu_runBlock does. Its
+// base cycles must be in pendingCycles already. The last instruction
+// leaves the block wherever the handler went; any other one leaves early
+// when the handler dropped blocks, giving back the instructions it
+// didn't get to. A fused handler runs the next instruction as well, unless
+// the first dropped blocks; it then gives that one back too. The handler
+// may change any register, so none are loaded afterwards.
+static void jit_call(JitBuffer *b, const CpuBlock *block, int index,
+        uint16_t pc) {
+    int remaining = block->count - index - 1 - block->ops[index].fused;
+
+    jit_flushCycles(b);
+    jit_spill(b);
+    jit_memory(b, JIT_WORD, 0xc7, 0, JIT_RBX, JIT_FIELD(pc));
+    jit_bytes(b, pc, 2);
+    jit_register(b, JIT_WIDE, 0x89, JIT_RBX, JIT_RDI);
+    jit_moveImmediate(b, JIT_RAX, (uintptr_t) block->ops[index].handler);
+    jit_register(b, 0, 0xff, 2, JIT_RAX);
+
+    b->loaded = 0;
+    if (block->ops[index].fused) {
+        jit_memory(b, 0, 0x80, 7, JIT_RBX, JIT_FIELD(pairSplit));
+        jit_byte(b, 0);
+        size_t whole = jit_jump(b, JIT_EQUAL);
+        jit_memory(b, JIT_WIDE, 0x81, 0, JIT_RBX,
+                JIT_FIELD(jitInstructionsLeft));
+        jit_bytes(b, 1, 4);
+        jit_memory(b, 0, 0xc6, 0, JIT_RBX, JIT_FIELD(pairSplit));
+        jit_byte(b, 0);
+        jit_land(b, whole);
+    }
+    if (remaining == 0) {
+        jit_exitDynamic(b);
+        return;
+    }
+    jit_memory(b, 0, 0x80, 7, JIT_RBX, JIT_FIELD(blockDropped));
+    jit_byte(b, 0);
+    size_t kept = jit_jump(b, JIT_EQUAL);
+    jit_memory(b, JIT_WIDE, 0x81, 0, JIT_RBX, JIT_FIELD(jitInstructionsLeft));
+    jit_bytes(b, remaining, 4);
+    jit_leave(b, JIT_ALWAYS);
+    jit_land(b, kept);
+}
+
+// Branches end their block, so both ways out are exits.
+static bool jit_branch(JitBuffer *b, uint8_t opcode, uint16_t pc,
+        uint8_t offset) {
+    uint16_t next = pc + 2;
+    uint16_t target = next + (int8_t) offset;
+    int taken;
+
+    switch (opcode) {
+        case 0x10: // BPL
+        case 0x30: // BMI
+            jit_memory(b, 0, 0xf6, 0, JIT_RBX, JIT_FIELD(flagN));
+            jit_byte(b, 0x80);
+            taken = opcode == 0x30 ? JIT_NOT_EQUAL : JIT_EQUAL;
+            break;
+        case 0xd0: // BNE
+        case 0xf0: // BEQ
+            jit_memory(b, 0, 0x80, 7, JIT_RBX, JIT_FIELD(flagZ));
+            jit_byte(b, 0);
+            taken = opcode == 0xf0 ? JIT_EQUAL : JIT_NOT_EQUAL;
+            break;
+        case 0x90: // BCC
+        case 0xb0: // BCS
+#ifdef CPU_LAZY_FLAGS
+            jit_memory(b, JIT_WORD, 0x81, 7, JIT_RBX, JIT_FIELD(flagC));
+            jit_bytes(b, 0xff, 2);
+            taken = opcode == 0xb0 ? JIT_ABOVE : JIT_BELOW_EQUAL;
+#else
+            jit_memory(b, 0, 0xf6, 0, JIT_RBX, JIT_FIELD(p));
+            jit_byte(b, FLAG_CARRY);
+            taken = opcode == 0xb0 ? JIT_NOT_EQUAL : JIT_EQUAL;
+#endif
+            break;
+        case 0x50: // BVC
+        case 0x70: // BVS
+#ifdef CPU_LAZY_FLAGS
+            jit_memory(b, 0, 0x0fb6, JIT_RAX, JIT_RBX, JIT_FIELD(flagVAcc));
+            jit_memory(b, 0, 0x22, JIT_RAX, JIT_RBX,
+                    JIT_FIELD(flagVOperand));
+            jit_byte(b, 0xa8);
+            jit_byte(b, 0x80);
+#else
+            jit_memory(b, 0, 0xf6, 0, JIT_RBX, JIT_FIELD(p));
+            jit_byte(b, FLAG_OVERFLOW);
+#endif
+            taken = opcode == 0x70 ? JIT_NOT_EQUAL : JIT_EQUAL;
+            break;
+        default:
+            return false;
+    }
+
+    uint32_t cycles = b->pendingCycles;
+    uint8_t dirty = b->dirty;
+    size_t jump = jit_jump(b, taken);
+    jit_exit(b, next);
+    jit_land(b, jump);
+    b->pendingCycles = cycles + 1 + (((next ^ target) & 0xff00) != 0);
+    b->dirty = dirty;
+    jit_exit(b, target);
+    return true;
+}
+
+static int jit_registerOf(uint8_t opcode) {
+    switch (opcode & 0x03) {
+        case 0x01:
+            return JIT_R12;
+        case 0x02:
+            return JIT_R13;
+        default:
+            return JIT_R14;
+    }
+}
+
+// Emits instruction index inline if it is one of the common simple ones,
+// with its base cycles already in pendingCycles. Returns false for the
+// rest, which go through their handlers.
+static bool jit_inline(JitBuffer *b, Cpu *cpu, const CpuBlock *block,
+        int index, uint16_t pc) {
+    uint8_t opcode = block->ops[index].opcode;
+    uint8_t length = disasm_opcodes[opcode].length;
+    uint8_t low = length > 1 ? cpu_read(cpu, pc + 1) : 0;
+    uint16_t address = low | (length > 2 ? cpu_read(cpu, pc + 2) << 8 : 0);
+    int reg = jit_registerOf(opcode);
+    int source = JIT_R12;
+
+    switch (opcode) {
+        case 0xa9: // LDA #
+        case 0xa2: // LDX #
+        case 0xa0: // LDY #
+            jit_define(b, reg);
+            jit_moveImmediate(b, reg, low);
+            jit_setZN(b, reg);
+            return true;
+        case 0xa5: // LDA zp
+        case 0xa6: // LDX zp
+        case 0xa4: // LDY zp
+            address = low;
+            // fallthrough
+        case 0xad: // LDA abs
+        case 0xae: // LDX abs
+        case 0xac: { // LDY abs
+            // Mappings only change through calls, which check for the
+            // blocks being dropped as they are then.
+            const uint8_t *data = cpu->pages[address >> 8].read;
+
+            if (!data) {
+                return false;
+            }
+            jit_define(b, reg);
+            jit_moveImmediate(b, JIT_RAX,
+                    (uintptr_t) (data + (address & 0xff)));
+            jit_memory(b, 0, 0x0fb6, reg, JIT_RAX, 0);
+            jit_setZN(b, reg);
+            return true;
+        }
+        case 0x85: // STA zp
+        case 0x86: // STX zp
+        case 0x84: // STY zp
+            address = low;
+            // fallthrough
+        case 0x8d: // STA abs
+        case 0x8e: // STX abs
+        case 0x8c: { // STY abs
+            // Straight into the page when it has a write pointer, looked up
+            // as it runs; through the handler when it doesn't (ROM, devices,
+            // armed traps), after which the registers are reloaded so both
+            // ways end in the same state.
+            uint8_t loaded = b->loaded | 1 << (reg - JIT_R12);
+            uint8_t dirty = b->dirty;
+
+            jit_use(b, reg);
+            jit_flushCycles(b);
+            jit_memory(b, JIT_WIDE, 0x8b, JIT_RAX, JIT_RBX,
+                    JIT_FIELD(pages) + (address >> 8) * (int32_t) sizeof(Page)
+                    + offsetof(Page, write));
+            jit_register(b, JIT_WIDE, 0x85, JIT_RAX, JIT_RAX);
+            size_t slow = jit_jump(b, JIT_EQUAL);
+            jit_memory(b, 0, 0x88, reg, JIT_RAX, address & 0xff);
+            size_t done = jit_jump(b, JIT_ALWAYS);
+            jit_land(b, slow);
+            jit_call(b, block, index, pc);
+            jit_reload(b, loaded);
+            jit_land(b, done);
+            b->dirty = dirty;
+            return true;
+        }
+        case 0xaa: // TAX
+        case 0xa8: // TAY
+            reg = opcode == 0xaa ? JIT_R13 : JIT_R14;
+            jit_use(b, JIT_R12);
+            jit_define(b, reg);
+            jit_register(b, 0, 0x89, JIT_R12, reg);
+            jit_setZN(b, reg);
+            return true;
+        case 0x8a: // TXA
+        case 0x98: // TYA
+            source = opcode == 0x8a ? JIT_R13 : JIT_R14;
+            jit_use(b, source);
+            jit_define(b, JIT_R12);
+            jit_register(b, 0, 0x89, source, JIT_R12);
+            jit_setZN(b, JIT_R12);
+            return true;
+        case 0xe8: // INX
+        case 0xca: // DEX
+        case 0xc8: // INY
+        case 0x88: // DEY
+            reg = (opcode == 0xe8 || opcode == 0xca) ? JIT_R13 : JIT_R14;
+            jit_use(b, reg);
+            jit_define(b, reg);
+            jit_register(b, 0, 0xfe, (opcode == 0xe8 || opcode == 0xc8)
+                    ? 0 : 1, reg);
+            jit_setZN(b, reg);
+            return true;
+        case 0x18: // CLC
+        case 0x38: // SEC
+#ifdef CPU_LAZY_FLAGS
+            jit_memory(b, JIT_WORD, 0xc7, 0, JIT_RBX, JIT_FIELD(flagC));
+            jit_bytes(b, opcode == 0x38 ? 0x100 : 0, 2);
+#else
+            jit_memory(b, 0, 0x80, opcode == 0x38 ? 1 : 4, JIT_RBX,
+                    JIT_FIELD(p));
+            jit_byte(b, opcode == 0x38 ? FLAG_CARRY
+                    : (uint8_t) ~FLAG_CARRY);
+#endif
+            return true;
+        case 0xea: // NOP
+            return true;
+        case 0x09: // ORA #
+        case 0x29: // AND #
+        case 0x49: // EOR #
+            jit_use(b, JIT_R12);
+            jit_define(b, JIT_R12);
+            jit_register(b, 0, 0x80, opcode == 0x09 ? 1
+                    : opcode == 0x29 ? 4 : 6, JIT_R12);
+            jit_byte(b, low);
+            jit_setZN(b, JIT_R12);
+            return true;
+        case 0xc9: // CMP #
+        case 0xe0: // CPX #
+        case 0xc0: // CPY #
+            reg = opcode == 0xc9 ? JIT_R12 : opcode == 0xe0 ? JIT_R13
+                : JIT_R14;
+            jit_use(b, reg);
+            jit_register(b, 0, 0x89, reg, JIT_RAX);
+            jit_register(b, 0, 0x80, 5, JIT_RAX);
+            jit_byte(b, low);
+            jit_setZN(b, JIT_RAX);
+            jit_register(b, 0, 0x80, 7, reg);
+            jit_byte(b, low);
+            jit_register(b, 0, 0x0f90 | JIT_ABOVE_EQUAL, 0, JIT_RAX);
+#ifdef CPU_LAZY_FLAGS
+            jit_register(b, 0, 0x0fb6, JIT_RAX, JIT_RAX);
+            jit_register(b, 0, 0xc1, 4, JIT_RAX);
+            jit_byte(b, 8);
+            jit_memory(b, JIT_WORD, 0x89, JIT_RAX, JIT_RBX, JIT_FIELD(flagC));
+#else
+            jit_memory(b, 0, 0x80, 4, JIT_RBX, JIT_FIELD(p));
+            jit_byte(b, (uint8_t) ~FLAG_CARRY);
+            jit_memory(b, 0, 0x08, JIT_RAX, JIT_RBX, JIT_FIELD(p));
+#endif
+            return true;
+        case 0x4c: // JMP abs
+            jit_exit(b, address);
+            return true;
+    }
+
+    if (disasm_opcodes[opcode].mode == MODE_RELATIVE) {
+        return jit_branch(b, opcode, pc, low);
+    }
+    return false;
+}
+
+bool jit_compile(Cpu *cpu, CpuBlock *block) {
+    JitBuffer buffer;
+    JitBuffer *b = &buffer;
+    uint8_t *space = jit_codeSpace(cpu);
+    uint16_t pc = block->start;
+    bool exited = false;
+
+    // Idle loops stay with cpu_run, which can skip their iterations.
+    if (!space || block->count == 0 || block->idle) {
+        return false;
+    }
+    b->size = 0;
+    b->leaveCount = 0;
+    b->overflow = false;
+    b->pendingCycles = 0;
+    b->loaded = 0;
+    b->dirty = 0;
+
+    // Enter only if the whole block fits within both limits, as cpu_run
+    // checks for interpreted blocks.
+    jit_memory(b, JIT_WIDE, 0x81, 7, JIT_RBX, JIT_FIELD(jitInstructionsLeft));
+    jit_bytes(b, block->count, 4);
+    jit_leave(b, JIT_BELOW);
+    jit_memory(b, JIT_WIDE, 0x8b, JIT_RAX, JIT_RBX, JIT_FIELD(cycles));
+    jit_register(b, JIT_WIDE, 0x81, 0, JIT_RAX);
+    jit_bytes(b, block->count * CPU_MAX_INSTRUCTION_CYCLES, 4);
+    jit_memory(b, JIT_WIDE, 0x3b, JIT_RAX, JIT_RBX, JIT_FIELD(jitCycleLimit));
+    jit_leave(b, JIT_ABOVE_EQUAL);
+    jit_memory(b, JIT_WIDE, 0x81, 5, JIT_RBX, JIT_FIELD(jitInstructionsLeft));
+    jit_bytes(b, block->count, 4);
+    jit_memory(b, 0, 0xc6, 0, JIT_RBX, JIT_FIELD(blockDropped));
+    jit_byte(b, 0);
+
+    // The first of a fused pair is inlined by itself when it can be;
+    // otherwise the fused handler runs both.
+    for (int i = 0; i < block->count; i++) {
+        uint8_t opcode = block->ops[i].opcode;
+
+        b->pendingCycles += block->ops[i].cycles;
+        if (jit_inline(b, cpu, block, i, pc)) {
+            exited = opcode == 0x4c
+                || disasm_opcodes[opcode].mode == MODE_RELATIVE;
+        } else {
+            jit_call(b, block, i, pc);
+            if (block->ops[i].fused) {
+                pc += disasm_opcodes[opcode].length;
+                opcode = block->ops[++i].opcode;
+            }
+            exited = i == block->count - 1;
+        }
+        pc += disasm_opcodes[opcode].length;
+    }
+    if (!exited) {
+        jit_exit(b, pc);
+    }
+
+    size_t body = b->size;
+    for (size_t i = 0; i < sizeof(jit_return); i++) {
+        jit_byte(b, jit_return[i]);
+    }
+    if (b->overflow) {
+        return false;
+    }
+    for (int i = 0; i < b->leaveCount; i++) {
+        uint32_t distance = body - b->leaves[i];
+        memcpy(&b->code[b->leaves[i] - 4], &distance, 4);
+    }
+
+    size_t size = (b->size + JIT_ALIGN - 1) & ~(size_t) (JIT_ALIGN - 1);
+    if (JIT_ENTER_SPACE + cpu->jitUsed + size > JIT_CODE_SPACE) {
+        jit_reclaim(cpu);
+    }
+
+    size_t at = JIT_ENTER_SPACE + cpu->jitUsed;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t *first = space + (at & ~(pageSize - 1));
+    size_t length = space + at + b->size - first;
+
+    if (mprotect(first, length, PROT_READ | PROT_WRITE) < 0) {
+        return false;
+    }
+    memcpy(space + at, b->code, b->size);
+    // Other blocks' code may share these pages and can't run until they
+    // are executable again.
+    if (mprotect(first, length, PROT_READ | PROT_EXEC) < 0) {
+        jit_reclaim(cpu);
+        return false;
+    }
+    cpu->jitUsed += size;
+    block->native = space + at;
+    return true;
+}
+
+void jit_release(Cpu *cpu) {
+    if (cpu->jitCode) {
+        jit_reclaim(cpu);
+        munmap(cpu->jitCode, JIT_CODE_SPACE);
+        cpu->jitCode = NULL;
+    }
+}
+
+uint64_t jit_run(Cpu *cpu, const CpuBlock *block, uint64_t maxInstructions,
+        uint64_t cycleLimit) {
+    void (*enter)(Cpu *cpu, void *code) =
+        (void (*)(Cpu *, void *)) (void *) cpu->jitCode;
+
+    cpu->jitInstructionsLeft = maxInstructions;
+    cpu->jitCycleLimit = cycleLimit;
+    enter(cpu, block->native);
+    return maxInstructions - cpu->jitInstructionsLeft;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef JIT_H_INCLUDED_
+#define JIT_H_INCLUDED_
+
+#include "cpu.h"
+
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+// Times a block runs through its handlers before it gets compiled. Can be
+// set at build time; 1 compiles everything, for testing.
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 32
+#endif
+
+// Compiles a cached block to x86-64 code in block->native. Inside it A, X
+// and Y live in host registers; simple loads, stores, transfers, register
+// arithmetic, immediate logic and compares, flag changes, branches and
+// JMP are inlined, everything else calls the block's handler. Exits jump
+// straight into the next block's code when that is compiled and still
+// cached. Each Cpu has its own code space, reused from the start after
+// cpu_flushBlocks; when it fills up, every block goes back to its handlers
+// to be compiled again once hot. Fails if the space can't be mapped; the
+// block then stays interpreted.
+bool jit_compile(Cpu *cpu, CpuBlock *block);
+// Runs compiled code from block until it reaches a block without any or
+// one that might not finish within maxInstructions or below cycleLimit.
+// Returns the number of instructions executed, 0 if block didn't fit.
+uint64_t jit_run(Cpu *cpu, const CpuBlock *block, uint64_t maxInstructions,
+        uint64_t cycleLimit);
+// Unmaps the Cpu's code space; see cpu_release.
+void jit_release(Cpu *cpu);
+#endif
+
+#endif /* JIT_H_INCLUDED_ */
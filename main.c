@@ -1,25 +1,64 @@
 #include <stdio.h>
-#include <stdlib.h>
+#include <string.h>
 
 #include "cpu.h"
+#include "rom.h"
+#include "trace.h"
 
 int main(int argc, char *argv[]) {
     Cpu cpu;
     cpu_initialize(&cpu);
 
-    FILE *f = fopen(argv[1], "r");
-    fseek(f, 0, SEEK_END);
-    
-    int sz = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    byte *buffer = calloc(sz, sizeof(byte));
-    fread(buffer, 1, sz, f);
+    // -t prints every instruction as it runs; -T file writes a binary
+    // trace for tracedump instead.
+    TraceWriter *trace = NULL;
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[arg], "-t") == 0) {
+        cpu_setTraceHook(&cpu, cpu_debugTrace, NULL);
+        arg++;
+    } else if (argc > 3 && strcmp(argv[arg], "-T") == 0) {
+        trace = trace_open(argv[arg + 1], &cpu);
+        if (!trace) {
+            perror(argv[arg + 1]);
+            return 1;
+        }
+        cpu_setTraceHook(&cpu, trace_hook, trace);
+        arg += 2;
+    }
+
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-t | -T trace] rom\n", argv[0]);
+        return 1;
+    }
 
-    fclose(f);
+    Rom rom;
+    if (rom_open(&rom, argv[arg]) < 0) {
+        perror(argv[arg]);
+        return 1;
+    }
+    rom_map(&rom, &cpu);
 
-    while (cpu.pc < sz) {
-        cpu.pc += cpu_debugDecodeInstruction(&cpu, buffer);
+    // Runs until the program executes BRK or hits an opcode the CPU
+    // doesn't implement.
+    CpuStopReason reason;
+    cpu_run(&cpu, CPU_RUN_UNLIMITED, CPU_RUN_UNLIMITED, &reason);
+    if (trace && trace_close(trace) < 0) {
+        fprintf(stderr, "error writing trace\n");
+        return 1;
     }
-    
+    if (reason == CPU_STOP_ILLEGAL) {
+        fprintf(stderr, "illegal opcode $%02x at $%04x\n", 
+                cpu_peek(&cpu, cpu.pc), cpu.pc);
+        cpu_release(&cpu);
+        rom_close(&rom);
+        return 1;
+    }
+
+#ifdef CPU_PROFILE
+    cpu_dumpProfile(&cpu, stderr, 16);
+#endif
+
+    cpu_release(&cpu);
+    rom_close(&rom);
     return 0;
 }
@@ -0,0 +1,263 @@
+/*
+ * Per-instruction microbenchmarks. Each one is a tight loop of the same
+ * instruction repeated MICROBENCH_REPEAT times and closed by a JMP, so its
+ * time is the cost of that one instruction class and addressing mode in
+ * the interpreter loop.
+ *
+ *   cc -O2 -o microbench microbench.c cpu.c disasm.c -lm
+ *   ./microbench [-n instructions] [-r trials] [-b name]
+ *
+ * Every benchmark is timed over several trials (after one warm-up run)
+ * and reported as the mean ns/instruction with a 95% confidence interval,
+ * as JSON on stdout. -b runs only the benchmarks whose name starts with
+ * the given prefix. Like bench, build once per dispatch and flags option
+ * to compare them. The pair benchmarks repeat idioms that the blocks and
+ * JIT dispatches fuse; "fused" is how many fused ops the last trial ran.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+
+#define MICROBENCH_INSTRUCTIONS 2000000
+#define MICROBENCH_TRIALS 15
+#define MICROBENCH_REPEAT 64
+
+#define MICROBENCH_START 0x1000
+#define MICROBENCH_SUBROUTINE 0x3000
+
+typedef struct _microbench {
+    const char *name;
+    const char *group;
+    byte code[4];
+    uint8_t length;
+    uint8_t status;
+} Microbench;
+
+// Every loop starts with X = Y = $10 and A = $01. ($70,X) and ($80),Y
+// point at $2000, ($82),Y at $20f8 so that indexing crosses a page.
+static const Microbench microbench_all[] = {
+    { "lda_imm", "load", { 0xa9, 0x42 }, 2, 0 },
+    { "lda_zp", "load", { 0xa5, 0x90 }, 2, 0 },
+    { "lda_abs", "load", { 0xad, 0x00, 0x20 }, 3, 0 },
+    { "ldx_imm", "load", { 0xa2, 0x10 }, 2, 0 },
+    { "ldy_abs", "load", { 0xac, 0x10, 0x20 }, 3, 0 },
+    { "sta_zp", "store", { 0x85, 0x90 }, 2, 0 },
+    { "sta_abs", "store", { 0x8d, 0x00, 0x20 }, 3, 0 },
+    { "stx_zp", "store", { 0x86, 0x90 }, 2, 0 },
+    { "sty_abs", "store", { 0x8c, 0x00, 0x20 }, 3, 0 },
+    { "tax", "transfer", { 0xaa }, 1, 0 },
+    { "tsx", "transfer", { 0xba }, 1, 0 },
+    { "inx", "transfer", { 0xe8 }, 1, 0 },
+    { "and_imm", "logic", { 0x29, 0xff }, 2, 0 },
+    { "ora_zp", "logic", { 0x05, 0x90 }, 2, 0 },
+    { "eor_abs", "logic", { 0x4d, 0x00, 0x20 }, 3, 0 },
+    { "bit_zp", "logic", { 0x24, 0x90 }, 2, 0 },
+    { "cmp_imm", "compare", { 0xc9, 0x01 }, 2, 0 },
+    { "cpx_zp", "compare", { 0xe4, 0x90 }, 2, 0 },
+    { "asl_acc", "rmw", { 0x0a }, 1, 0 },
+    { "asl_zp", "rmw", { 0x06, 0x90 }, 2, 0 },
+    { "rol_abs", "rmw", { 0x2e, 0x00, 0x20 }, 3, 0 },
+    { "lsr_zpx", "rmw", { 0x56, 0x90 }, 2, 0 },
+    { "ror_absx", "rmw", { 0x7e, 0x00, 0x20 }, 3, 0 },
+    { "inc_zp", "rmw", { 0xe6, 0x90 }, 2, 0 },
+    { "dec_abs", "rmw", { 0xce, 0x00, 0x20 }, 3, 0 },
+    { "bne_taken", "branch", { 0xd0, 0x00 }, 2, 0 },
+    { "beq_not_taken", "branch", { 0xf0, 0x00 }, 2, 0 },
+    { "pha", "stack", { 0x48 }, 1, 0 },
+    { "pla", "stack", { 0x68 }, 1, 0 },
+    { "php", "stack", { 0x08 }, 1, 0 },
+    { "plp", "stack", { 0x28 }, 1, 0 },
+    { "jsr_rts", "stack", { 0x20, MICROBENCH_SUBROUTINE & 0xff,
+            MICROBENCH_SUBROUTINE >> 8 }, 3, 0 },
+    { "clc", "flag", { 0x18 }, 1, 0 },
+    { "sec", "flag", { 0x38 }, 1, 0 },
+    { "adc_imm", "arith", { 0x69, 0x35 }, 2, 0 },
+    { "adc_zp", "arith", { 0x65, 0x90 }, 2, 0 },
+    { "sbc_imm", "arith", { 0xe9, 0x35 }, 2, 0 },
+    { "adc_imm_decimal", "arith", { 0x69, 0x35 }, 2, FLAG_DECIMAL },
+    { "sbc_imm_decimal", "arith", { 0xe9, 0x35 }, 2, FLAG_DECIMAL },
+    { "lda_zpx", "mode", { 0xb5, 0x80 }, 2, 0 },
+    { "lda_absx", "mode", { 0xbd, 0x00, 0x20 }, 3, 0 },
+    { "lda_absx_cross", "mode", { 0xbd, 0xf8, 0x20 }, 3, 0 },
+    { "lda_absy", "mode", { 0xb9, 0x00, 0x20 }, 3, 0 },
+    { "lda_iiax", "mode", { 0xa1, 0x70 }, 2, 0 },
+    { "lda_iiay", "mode", { 0xb1, 0x80 }, 2, 0 },
+    { "lda_iiay_cross", "mode", { 0xb1, 0x82 }, 2, 0 },
+    { "sta_zpx", "mode", { 0x95, 0x80 }, 2, 0 },
+    { "sta_absx", "mode", { 0x9d, 0x00, 0x20 }, 3, 0 },
+    { "sta_iiax", "mode", { 0x81, 0x70 }, 2, 0 },
+    { "sta_iiay", "mode", { 0x91, 0x80 }, 2, 0 },
+    { "lda_sta", "pair", { 0xa5, 0x90, 0x85, 0x91 }, 4, 0 },
+    { "dex_bne", "pair", { 0xca, 0xd0, 0x00 }, 3, 0 },
+    { "clc_adc", "pair", { 0x18, 0x69, 0x35 }, 3, 0 },
+    { "sec_sbc", "pair", { 0x38, 0xe9, 0x35 }, 3, 0 },
+    { "cmp_bne", "pair", { 0xc9, 0x01, 0xd0, 0x00 }, 4, 0 },
+};
+
+static const char *microbench_dispatchName(void) {
+    switch (CPU_DISPATCH) {
+        case CPU_DISPATCH_SWITCH:
+            return "switch";
+        case CPU_DISPATCH_TABLE:
+            return "table";
+        case CPU_DISPATCH_THREADED:
+            return "threaded";
+        case CPU_DISPATCH_BLOCKS:
+            return "blocks";
+        case CPU_DISPATCH_JIT:
+            return "jit";
+    }
+    return "unknown";
+}
+
+static const char *microbench_flagsName(void) {
+#ifdef CPU_LAZY_FLAGS
+    return "lazy";
+#else
+    return "eager";
+#endif
+}
+
+static double microbench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Two-sided 95% Student's t for 1 to 30 degrees of freedom; beyond that
+// the normal value is close enough.
+static double microbench_t95(int degrees) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+        2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+        2.048, 2.045, 2.042
+    };
+
+    if (degrees < 1) {
+        return 0;
+    }
+    return degrees <= 30 ? table[degrees - 1] : 1.960;
+}
+
+static void microbench_load(Cpu *cpu, const Microbench *bench) {
+    uint16_t address = MICROBENCH_START;
+
+    cpu_initialize(cpu);
+    cpu_mapFlat(cpu);
+
+    for (int i = 0; i < MICROBENCH_REPEAT; i++) {
+        memcpy(&cpu->memory[address], bench->code, bench->length);
+        address += bench->length;
+    }
+    cpu->memory[address] = 0x4c;
+    cpu->memory[address + 1] = MICROBENCH_START & 0xff;
+    cpu->memory[address + 2] = MICROBENCH_START >> 8;
+    cpu->memory[MICROBENCH_SUBROUTINE] = 0x60;
+
+    cpu->memory[0x80] = 0x00;
+    cpu->memory[0x81] = 0x20;
+    cpu->memory[0x82] = 0xf8;
+    cpu->memory[0x83] = 0x20;
+
+    cpu->acc = 0x01;
+    cpu->x = 0x10;
+    cpu->y = 0x10;
+    cpu->pc = MICROBENCH_START;
+    cpu_setStatus(cpu, bench->status);
+    cpu_flushBlocks(cpu);
+}
+
+static void microbench_run(Cpu *cpu, const Microbench *bench,
+        long instructions, int trials, bool first) {
+    double samples[trials];
+    double sum = 0;
+    double best = 0;
+    unsigned long long fused = 0;
+
+    microbench_load(cpu, bench);
+    cpu_run(cpu, instructions, CPU_RUN_UNLIMITED, NULL);
+    cpu_release(cpu);
+
+    for (int trial = 0; trial < trials; trial++) {
+        microbench_load(cpu, bench);
+
+        double start = microbench_now();
+        cpu_run(cpu, instructions, CPU_RUN_UNLIMITED, NULL);
+        double ns = (microbench_now() - start) * 1e9 / instructions;
+
+        cpu_release(cpu);
+#ifdef CPU_BLOCK_CACHE
+        fused = cpu->fusedOps;
+#endif
+        samples[trial] = ns;
+        sum += ns;
+        if (trial == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    double mean = sum / trials;
+    double variance = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        variance += (samples[trial] - mean) * (samples[trial] - mean);
+    }
+    double stddev = trials > 1 ? sqrt(variance / (trials - 1)) : 0;
+    double ci95 = microbench_t95(trials - 1) * stddev / sqrt(trials);
+
+    printf("%s    {\"name\": \"%s\", \"group\": \"%s\", \"ns\": %.4f, "
+            "\"ci95\": %.4f, \"stddev\": %.4f, \"min\": %.4f, "
+            "\"fused\": %llu}", first ? "" : ",\n", bench->name,
+            bench->group, mean, ci95, stddev, best, fused);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    long instructions = MICROBENCH_INSTRUCTIONS;
+    int trials = MICROBENCH_TRIALS;
+    const char *prefix = "";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            instructions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            trials = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-n instructions] [-r trials] "
+                    "[-b name]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (instructions < 1 || trials < 1) {
+        fprintf(stderr, "instructions and trials must be positive\n");
+        return 1;
+    }
+
+    Cpu *cpu = malloc(sizeof(Cpu));
+    size_t count = sizeof(microbench_all) / sizeof(microbench_all[0]);
+    bool first = true;
+
+    printf("{\n  \"dispatch\": \"%s\",\n  \"flags\": \"%s\",\n"
+            "  \"instructions\": %ld,\n  \"trials\": %d,\n"
+            "  \"repeat\": %d,\n  \"benchmarks\": [\n",
+            microbench_dispatchName(), microbench_flagsName(),
+            instructions, trials, MICROBENCH_REPEAT);
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(microbench_all[i].name, prefix, strlen(prefix)) == 0) {
+            microbench_run(cpu, &microbench_all[i], instructions, trials,
+                    first);
+            first = false;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    free(cpu);
+
+    return 0;
+}
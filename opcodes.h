@@ -0,0 +1,283 @@
+#ifndef OPCODES_H_INCLUDED_
+#define OPCODES_H_INCLUDED_
+
+typedef enum _addressMode {
+    MODE_IMPLIED,
+    MODE_ACCUMULATOR,
+    MODE_IMMEDIATE,
+    MODE_ZERO_PAGE,
+    MODE_ZERO_PAGE_X,
+    MODE_ZERO_PAGE_Y,
+    MODE_ABSOLUTE,
+    MODE_ABSOLUTE_X,
+    MODE_ABSOLUTE_Y,
+    MODE_INDIRECT,
+    MODE_INDEXED_INDIRECT,
+    MODE_INDIRECT_INDEXED,
+    MODE_RELATIVE
+} AddressMode;
+
+// Every opcode as X(opcode, handler, mnemonic, mode, cycles). The handler
+// is cpu_op##handler in cpu.c and the cycles are the base count, before
+// page-crossing and branch penalties. Opcodes the CPU doesn't implement
+// run Illegal and have no mnemonic. The executor and the disassembler are
+// both generated from this list, so they can't disagree.
+#define CPU_OPCODES(X) \
+    X(0x00, Brk, "BRK", IMPLIED, 7) \
+    X(0x01, OraIIAX, "ORA", INDEXED_INDIRECT, 6) \
+    X(0x02, Illegal, NULL, IMPLIED, 2) \
+    X(0x03, Illegal, NULL, IMPLIED, 2) \
+    X(0x04, Illegal, NULL, IMPLIED, 2) \
+    X(0x05, OraZp, "ORA", ZERO_PAGE, 3) \
+    X(0x06, AslZp, "ASL", ZERO_PAGE, 5) \
+    X(0x07, Illegal, NULL, IMPLIED, 2) \
+    X(0x08, Php, "PHP", IMPLIED, 3) \
+    X(0x09, OraImm, "ORA", IMMEDIATE, 2) \
+    X(0x0a, AslAcc, "ASL", ACCUMULATOR, 2) \
+    X(0x0b, Illegal, NULL, IMPLIED, 2) \
+    X(0x0c, Illegal, NULL, IMPLIED, 2) \
+    X(0x0d, OraAbs, "ORA", ABSOLUTE, 4) \
+    X(0x0e, AslAbs, "ASL", ABSOLUTE, 6) \
+    X(0x0f, Illegal, NULL, IMPLIED, 2) \
+    X(0x10, Bpl, "BPL", RELATIVE, 2) \
+    X(0x11, OraIIAY, "ORA", INDIRECT_INDEXED, 5) \
+    X(0x12, Illegal, NULL, IMPLIED, 2) \
+    X(0x13, Illegal, NULL, IMPLIED, 2) \
+    X(0x14, Illegal, NULL, IMPLIED, 2) \
+    X(0x15, OraZpX, "ORA", ZERO_PAGE_X, 4) \
+    X(0x16, AslZpX, "ASL", ZERO_PAGE_X, 6) \
+    X(0x17, Illegal, NULL, IMPLIED, 2) \
+    X(0x18, Clc, "CLC", IMPLIED, 2) \
+    X(0x19, OraAbsY, "ORA", ABSOLUTE_Y, 4) \
+    X(0x1a, Illegal, NULL, IMPLIED, 2) \
+    X(0x1b, Illegal, NULL, IMPLIED, 2) \
+    X(0x1c, Illegal, NULL, IMPLIED, 2) \
+    X(0x1d, OraAbsX, "ORA", ABSOLUTE_X, 4) \
+    X(0x1e, AslAbsX, "ASL", ABSOLUTE_X, 7) \
+    X(0x1f, Illegal, NULL, IMPLIED, 2) \
+    X(0x20, Jsr, "JSR", ABSOLUTE, 6) \
+    X(0x21, AndIIAX, "AND", INDEXED_INDIRECT, 6) \
+    X(0x22, Illegal, NULL, IMPLIED, 2) \
+    X(0x23, Illegal, NULL, IMPLIED, 2) \
+    X(0x24, BitZp, "BIT", ZERO_PAGE, 3) \
+    X(0x25, AndZp, "AND", ZERO_PAGE, 3) \
+    X(0x26, RolZp, "ROL", ZERO_PAGE, 5) \
+    X(0x27, Illegal, NULL, IMPLIED, 2) \
+    X(0x28, Plp, "PLP", IMPLIED, 4) \
+    X(0x29, AndImm, "AND", IMMEDIATE, 2) \
+    X(0x2a, RolAcc, "ROL", ACCUMULATOR, 2) \
+    X(0x2b, Illegal, NULL, IMPLIED, 2) \
+    X(0x2c, BitAbs, "BIT", ABSOLUTE, 4) \
+    X(0x2d, AndAbs, "AND", ABSOLUTE, 4) \
+    X(0x2e, RolAbs, "ROL", ABSOLUTE, 6) \
+    X(0x2f, Illegal, NULL, IMPLIED, 2) \
+    X(0x30, Bmi, "BMI", RELATIVE, 2) \
+    X(0x31, AndIIAY, "AND", INDIRECT_INDEXED, 5) \
+    X(0x32, Illegal, NULL, IMPLIED, 2) \
+    X(0x33, Illegal, NULL, IMPLIED, 2) \
+    X(0x34, Illegal, NULL, IMPLIED, 2) \
+    X(0x35, AndZpX, "AND", ZERO_PAGE_X, 4) \
+    X(0x36, RolZpX, "ROL", ZERO_PAGE_X, 6) \
+    X(0x37, Illegal, NULL, IMPLIED, 2) \
+    X(0x38, Sec, "SEC", IMPLIED, 2) \
+    X(0x39, AndAbsY, "AND", ABSOLUTE_Y, 4) \
+    X(0x3a, Illegal, NULL, IMPLIED, 2) \
+    X(0x3b, Illegal, NULL, IMPLIED, 2) \
+    X(0x3c, Illegal, NULL, IMPLIED, 2) \
+    X(0x3d, AndAbsX, "AND", ABSOLUTE_X, 4) \
+    X(0x3e, RolAbsX, "ROL", ABSOLUTE_X, 7) \
+    X(0x3f, Illegal, NULL, IMPLIED, 2) \
+    X(0x40, Rti, "RTI", IMPLIED, 6) \
+    X(0x41, EorIIAX, "EOR", INDEXED_INDIRECT, 6) \
+    X(0x42, Illegal, NULL, IMPLIED, 2) \
+    X(0x43, Illegal, NULL, IMPLIED, 2) \
+    X(0x44, Illegal, NULL, IMPLIED, 2) \
+    X(0x45, EorZp, "EOR", ZERO_PAGE, 3) \
+    X(0x46, LsrZp, "LSR", ZERO_PAGE, 5) \
+    X(0x47, Illegal, NULL, IMPLIED, 2) \
+    X(0x48, Pha, "PHA", IMPLIED, 3) \
+    X(0x49, EorImm, "EOR", IMMEDIATE, 2) \
+    X(0x4a, LsrAcc, "LSR", ACCUMULATOR, 2) \
+    X(0x4b, Illegal, NULL, IMPLIED, 2) \
+    X(0x4c, JmpAbs, "JMP", ABSOLUTE, 3) \
+    X(0x4d, EorAbs, "EOR", ABSOLUTE, 4) \
+    X(0x4e, LsrAbs, "LSR", ABSOLUTE, 6) \
+    X(0x4f, Illegal, NULL, IMPLIED, 2) \
+    X(0x50, Bvc, "BVC", RELATIVE, 2) \
+    X(0x51, EorIIAY, "EOR", INDIRECT_INDEXED, 5) \
+    X(0x52, Illegal, NULL, IMPLIED, 2) \
+    X(0x53, Illegal, NULL, IMPLIED, 2) \
+    X(0x54, Illegal, NULL, IMPLIED, 2) \
+    X(0x55, EorZpX, "EOR", ZERO_PAGE_X, 4) \
+    X(0x56, LsrZpX, "LSR", ZERO_PAGE_X, 6) \
+    X(0x57, Illegal, NULL, IMPLIED, 2) \
+    X(0x58, Cli, "CLI", IMPLIED, 2) \
+    X(0x59, EorAbsY, "EOR", ABSOLUTE_Y, 4) \
+    X(0x5a, Illegal, NULL, IMPLIED, 2) \
+    X(0x5b, Illegal, NULL, IMPLIED, 2) \
+    X(0x5c, Illegal, NULL, IMPLIED, 2) \
+    X(0x5d, EorAbsX, "EOR", ABSOLUTE_X, 4) \
+    X(0x5e, LsrAbsX, "LSR", ABSOLUTE_X, 7) \
+    X(0x5f, Illegal, NULL, IMPLIED, 2) \
+    X(0x60, Rts, "RTS", IMPLIED, 6) \
+    X(0x61, AdcIIAX, "ADC", INDEXED_INDIRECT, 6) \
+    X(0x62, Illegal, NULL, IMPLIED, 2) \
+    X(0x63, Illegal, NULL, IMPLIED, 2) \
+    X(0x64, Illegal, NULL, IMPLIED, 2) \
+    X(0x65, AdcZp, "ADC", ZERO_PAGE, 3) \
+    X(0x66, RorZp, "ROR", ZERO_PAGE, 5) \
+    X(0x67, Illegal, NULL, IMPLIED, 2) \
+    X(0x68, Pla, "PLA", IMPLIED, 4) \
+    X(0x69, AdcImm, "ADC", IMMEDIATE, 2) \
+    X(0x6a, RorAcc, "ROR", ACCUMULATOR, 2) \
+    X(0x6b, Illegal, NULL, IMPLIED, 2) \
+    X(0x6c, JmpInd, "JMP", INDIRECT, 5) \
+    X(0x6d, AdcAbs, "ADC", ABSOLUTE, 4) \
+    X(0x6e, RorAbs, "ROR", ABSOLUTE, 6) \
+    X(0x6f, Illegal, NULL, IMPLIED, 2) \
+    X(0x70, Bvs, "BVS", RELATIVE, 2) \
+    X(0x71, AdcIIAY, "ADC", INDIRECT_INDEXED, 5) \
+    X(0x72, Illegal, NULL, IMPLIED, 2) \
+    X(0x73, Illegal, NULL, IMPLIED, 2) \
+    X(0x74, Illegal, NULL, IMPLIED, 2) \
+    X(0x75, AdcZpX, "ADC", ZERO_PAGE_X, 4) \
+    X(0x76, RorZpX, "ROR", ZERO_PAGE_X, 6) \
+    X(0x77, Illegal, NULL, IMPLIED, 2) \
+    X(0x78, Sei, "SEI", IMPLIED, 2) \
+    X(0x79, AdcAbsY, "ADC", ABSOLUTE_Y, 4) \
+    X(0x7a, Illegal, NULL, IMPLIED, 2) \
+    X(0x7b, Illegal, NULL, IMPLIED, 2) \
+    X(0x7c, Illegal, NULL, IMPLIED, 2) \
+    X(0x7d, AdcAbsX, "ADC", ABSOLUTE_X, 4) \
+    X(0x7e, RorAbsX, "ROR", ABSOLUTE_X, 7) \
+    X(0x7f, Illegal, NULL, IMPLIED, 2) \
+    X(0x80, Illegal, NULL, IMPLIED, 2) \
+    X(0x81, StaIIAX, "STA", INDEXED_INDIRECT, 6) \
+    X(0x82, Illegal, NULL, IMPLIED, 2) \
+    X(0x83, Illegal, NULL, IMPLIED, 2) \
+    X(0x84, StyZp, "STY", ZERO_PAGE, 3) \
+    X(0x85, StaZp, "STA", ZERO_PAGE, 3) \
+    X(0x86, StxZp, "STX", ZERO_PAGE, 3) \
+    X(0x87, Illegal, NULL, IMPLIED, 2) \
+    X(0x88, Dey, "DEY", IMPLIED, 2) \
+    X(0x89, Illegal, NULL, IMPLIED, 2) \
+    X(0x8a, Txa, "TXA", IMPLIED, 2) \
+    X(0x8b, Illegal, NULL, IMPLIED, 2) \
+    X(0x8c, StyAbs, "STY", ABSOLUTE, 4) \
+    X(0x8d, StaAbs, "STA", ABSOLUTE, 4) \
+    X(0x8e, StxAbs, "STX", ABSOLUTE, 4) \
+    X(0x8f, Illegal, NULL, IMPLIED, 2) \
+    X(0x90, Bcc, "BCC", RELATIVE, 2) \
+    X(0x91, StaIIAY, "STA", INDIRECT_INDEXED, 6) \
+    X(0x92, Illegal, NULL, IMPLIED, 2) \
+    X(0x93, Illegal, NULL, IMPLIED, 2) \
+    X(0x94, StyZpX, "STY", ZERO_PAGE_X, 4) \
+    X(0x95, StaZpX, "STA", ZERO_PAGE_X, 4) \
+    X(0x96, StxZpY, "STX", ZERO_PAGE_Y, 4) \
+    X(0x97, Illegal, NULL, IMPLIED, 2) \
+    X(0x98, Tya, "TYA", IMPLIED, 2) \
+    X(0x99, StaAbsY, "STA", ABSOLUTE_Y, 5) \
+    X(0x9a, Txs, "TXS", IMPLIED, 2) \
+    X(0x9b, Illegal, NULL, IMPLIED, 2) \
+    X(0x9c, Illegal, NULL, IMPLIED, 2) \
+    X(0x9d, StaAbsX, "STA", ABSOLUTE_X, 5) \
+    X(0x9e, Illegal, NULL, IMPLIED, 2) \
+    X(0x9f, Illegal, NULL, IMPLIED, 2) \
+    X(0xa0, LdyImm, "LDY", IMMEDIATE, 2) \
+    X(0xa1, LdaIIAX, "LDA", INDEXED_INDIRECT, 6) \
+    X(0xa2, LdxImm, "LDX", IMMEDIATE, 2) \
+    X(0xa3, Illegal, NULL, IMPLIED, 2) \
+    X(0xa4, LdyZp, "LDY", ZERO_PAGE, 3) \
+    X(0xa5, LdaZp, "LDA", ZERO_PAGE, 3) \
+    X(0xa6, LdxZp, "LDX", ZERO_PAGE, 3) \
+    X(0xa7, Illegal, NULL, IMPLIED, 2) \
+    X(0xa8, Tay, "TAY", IMPLIED, 2) \
+    X(0xa9, LdaImm, "LDA", IMMEDIATE, 2) \
+    X(0xaa, Tax, "TAX", IMPLIED, 2) \
+    X(0xab, Illegal, NULL, IMPLIED, 2) \
+    X(0xac, LdyAbs, "LDY", ABSOLUTE, 4) \
+    X(0xad, LdaAbs, "LDA", ABSOLUTE, 4) \
+    X(0xae, LdxAbs, "LDX", ABSOLUTE, 4) \
+    X(0xaf, Illegal, NULL, IMPLIED, 2) \
+    X(0xb0, Bcs, "BCS", RELATIVE, 2) \
+    X(0xb1, LdaIIAY, "LDA", INDIRECT_INDEXED, 5) \
+    X(0xb2, Illegal, NULL, IMPLIED, 2) \
+    X(0xb3, Illegal, NULL, IMPLIED, 2) \
+    X(0xb4, LdyZpX, "LDY", ZERO_PAGE_X, 4) \
+    X(0xb5, LdaZpX, "LDA", ZERO_PAGE_X, 4) \
+    X(0xb6, LdxZpY, "LDX", ZERO_PAGE_Y, 4) \
+    X(0xb7, Illegal, NULL, IMPLIED, 2) \
+    X(0xb8, Clv, "CLV", IMPLIED, 2) \
+    X(0xb9, LdaAbsY, "LDA", ABSOLUTE_Y, 4) \
+    X(0xba, Tsx, "TSX", IMPLIED, 2) \
+    X(0xbb, Illegal, NULL, IMPLIED, 2) \
+    X(0xbc, LdyAbsX, "LDY", ABSOLUTE_X, 4) \
+    X(0xbd, LdaAbsX, "LDA", ABSOLUTE_X, 4) \
+    X(0xbe, LdxAbsY, "LDX", ABSOLUTE_Y, 4) \
+    X(0xbf, Illegal, NULL, IMPLIED, 2) \
+    X(0xc0, CpyImm, "CPY", IMMEDIATE, 2) \
+    X(0xc1, CmpIIAX, "CMP", INDEXED_INDIRECT, 6) \
+    X(0xc2, Illegal, NULL, IMPLIED, 2) \
+    X(0xc3, Illegal, NULL, IMPLIED, 2) \
+    X(0xc4, CpyZp, "CPY", ZERO_PAGE, 3) \
+    X(0xc5, CmpZp, "CMP", ZERO_PAGE, 3) \
+    X(0xc6, DecZp, "DEC", ZERO_PAGE, 5) \
+    X(0xc7, Illegal, NULL, IMPLIED, 2) \
+    X(0xc8, Iny, "INY", IMPLIED, 2) \
+    X(0xc9, CmpImm, "CMP", IMMEDIATE, 2) \
+    X(0xca, Dex, "DEX", IMPLIED, 2) \
+    X(0xcb, Illegal, NULL, IMPLIED, 2) \
+    X(0xcc, CpyAbs, "CPY", ABSOLUTE, 4) \
+    X(0xcd, CmpAbs, "CMP", ABSOLUTE, 4) \
+    X(0xce, DecAbs, "DEC", ABSOLUTE, 6) \
+    X(0xcf, Illegal, NULL, IMPLIED, 2) \
+    X(0xd0, Bne, "BNE", RELATIVE, 2) \
+    X(0xd1, CmpIIAY, "CMP", INDIRECT_INDEXED, 5) \
+    X(0xd2, Illegal, NULL, IMPLIED, 2) \
+    X(0xd3, Illegal, NULL, IMPLIED, 2) \
+    X(0xd4, Illegal, NULL, IMPLIED, 2) \
+    X(0xd5, CmpZpX, "CMP", ZERO_PAGE_X, 4) \
+    X(0xd6, DecZpX, "DEC", ZERO_PAGE_X, 6) \
+    X(0xd7, Illegal, NULL, IMPLIED, 2) \
+    X(0xd8, Cld, "CLD", IMPLIED, 2) \
+    X(0xd9, CmpAbsY, "CMP", ABSOLUTE_Y, 4) \
+    X(0xda, Illegal, NULL, IMPLIED, 2) \
+    X(0xdb, Illegal, NULL, IMPLIED, 2) \
+    X(0xdc, Illegal, NULL, IMPLIED, 2) \
+    X(0xdd, CmpAbsX, "CMP", ABSOLUTE_X, 4) \
+    X(0xde, DecAbsX, "DEC", ABSOLUTE_X, 7) \
+    X(0xdf, Illegal, NULL, IMPLIED, 2) \
+    X(0xe0, CpxImm, "CPX", IMMEDIATE, 2) \
+    X(0xe1, SbcIIAX, "SBC", INDEXED_INDIRECT, 6) \
+    X(0xe2, Illegal, NULL, IMPLIED, 2) \
+    X(0xe3, Illegal, NULL, IMPLIED, 2) \
+    X(0xe4, CpxZp, "CPX", ZERO_PAGE, 3) \
+    X(0xe5, SbcZp, "SBC", ZERO_PAGE, 3) \
+    X(0xe6, IncZp, "INC", ZERO_PAGE, 5) \
+    X(0xe7, Illegal, NULL, IMPLIED, 2) \
+    X(0xe8, Inx, "INX", IMPLIED, 2) \
+    X(0xe9, SbcImm, "SBC", IMMEDIATE, 2) \
+    X(0xea, Nop, "NOP", IMPLIED, 2) \
+    X(0xeb, Illegal, NULL, IMPLIED, 2) \
+    X(0xec, CpxAbs, "CPX", ABSOLUTE, 4) \
+    X(0xed, SbcAbs, "SBC", ABSOLUTE, 4) \
+    X(0xee, IncAbs, "INC", ABSOLUTE, 6) \
+    X(0xef, Illegal, NULL, IMPLIED, 2) \
+    X(0xf0, Beq, "BEQ", RELATIVE, 2) \
+    X(0xf1, SbcIIAY, "SBC", INDIRECT_INDEXED, 5) \
+    X(0xf2, Illegal, NULL, IMPLIED, 2) \
+    X(0xf3, Illegal, NULL, IMPLIED, 2) \
+    X(0xf4, Illegal, NULL, IMPLIED, 2) \
+    X(0xf5, SbcZpX, "SBC", ZERO_PAGE_X, 4) \
+    X(0xf6, IncZpX, "INC", ZERO_PAGE_X, 6) \
+    X(0xf7, Illegal, NULL, IMPLIED, 2) \
+    X(0xf8, Sed, "SED", IMPLIED, 2) \
+    X(0xf9, SbcAbsY, "SBC", ABSOLUTE_Y, 4) \
+    X(0xfa, Illegal, NULL, IMPLIED, 2) \
+    X(0xfb, Illegal, NULL, IMPLIED, 2) \
+    X(0xfc, Illegal, NULL, IMPLIED, 2) \
+    X(0xfd, SbcAbsX, "SBC", ABSOLUTE_X, 4) \
+    X(0xfe, IncAbsX, "INC", ABSOLUTE_X, 7) \
+    X(0xff, Illegal, NULL, IMPLIED, 2)
+
+#endif /* OPCODES_H_INCLUDED_ */
@@ -0,0 +1,544 @@
+/*
+ * Static recompiler: translates the basic blocks of a ROM to C ahead of
+ * time.
+ *
+ *   cc -O2 -o recompile recompile.c disasm.c
+ *   ./recompile rom > game.c
+ *   cc -O2 -DBENCH_RECOMPILED -o bench-game bench.c game.c recompiled.c \
+ *       disasm.c
+ *
+ * Blocks are found by walking the code from the start of the window and
+ * the reset and IRQ vectors, following branches, jumps and subroutine
+ * calls. Each becomes a C function doing what the interpreter would, with
+ * operands, cycle counts and flow resolved at translation time. The
+ * generated file includes cpu.c for its helpers, so it is linked instead
+ * of cpu.c, and recompiled_run (recompiled.h) dispatches to the blocks.
+ *
+ * Anything the walk can't see statically stays with the interpreter: the
+ * targets of JMP (ind), RTS and RTI are looked up at run time, BRK and
+ * illegal opcodes end a block before them, and code outside the ROM
+ * (self-modifying code has to live in RAM) never has a block. Only
+ * unbanked images of up to 4K are accepted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+
+#define RECOMPILE_WINDOW (ROM_END - ROM_START + 1)
+// Longer straight runs are split so the instruction budget of
+// recompiled_run stays fine-grained.
+#define RECOMPILE_MAX_BLOCK 64
+
+#define RECOMPILE_RESET_VECTOR 0xffc
+#define RECOMPILE_IRQ_VECTOR 0xffe
+
+typedef struct _recompiler {
+    byte window[RECOMPILE_WINDOW];
+    bool starts[RECOMPILE_WINDOW];
+    uint16_t pending[RECOMPILE_WINDOW];
+    int pendingCount;
+    // Instructions in the block at each offset, once written.
+    int counts[RECOMPILE_WINDOW];
+    FILE *out;
+} Recompiler;
+
+static void recompile_addStart(Recompiler *r, int offset);
+static void recompile_addAddress(Recompiler *r, uint16_t address);
+static bool recompile_decode(const Recompiler *r, int offset,
+        DisasmInstruction *ins);
+static bool recompile_endsBlock(const DisasmInstruction *ins);
+static int recompile_length(const Recompiler *r, int start,
+        DisasmInstruction *last);
+static void recompile_walk(Recompiler *r);
+static int recompile_block(Recompiler *r, int start);
+static bool recompile_isRead(const char *mnemonic);
+static void recompile_address(Recompiler *r, const DisasmInstruction *ins,
+        AddressMode mode);
+static bool recompile_operation(Recompiler *r, const DisasmInstruction *ins,
+        AddressMode mode);
+static bool recompile_flow(Recompiler *r, const DisasmInstruction *ins,
+        int offset);
+static void recompile_header(Recompiler *r, const char *path);
+static void recompile_table(Recompiler *r);
+
+static void recompile_addStart(Recompiler *r, int offset) {
+    if (offset < 0 || offset >= RECOMPILE_WINDOW || r->starts[offset]) {
+        return;
+    }
+    r->starts[offset] = true;
+    r->pending[r->pendingCount++] = offset;
+}
+
+// Absolute targets count when they land in any mirror of the window.
+static void recompile_addAddress(Recompiler *r, uint16_t address) {
+    if (address & ROM_START) {
+        recompile_addStart(r, address & (RECOMPILE_WINDOW - 1));
+    }
+}
+
+// Whether the instruction at offset is one a block can contain: known to
+// the CPU, not BRK (left to the interpreter, which also stops there) and
+// not running off the end of the window.
+static bool recompile_decode(const Recompiler *r, int offset,
+        DisasmInstruction *ins) {
+    const OpcodeInfo *info = &disasm_opcodes[r->window[offset]];
+
+    if (!info->mnemonic || r->window[offset] == 0x00
+            || offset + info->length > RECOMPILE_WINDOW) {
+        return false;
+    }
+    disasm_decode(&r->window[offset], info->length, ROM_START + offset, ins);
+    return true;
+}
+
+static bool recompile_endsBlock(const DisasmInstruction *ins) {
+    const OpcodeInfo *info = &disasm_opcodes[ins->opcode];
+
+    return info->mode == MODE_RELATIVE
+        || strcmp(info->mnemonic, "JMP") == 0
+        || strcmp(info->mnemonic, "JSR") == 0
+        || strcmp(info->mnemonic, "RTS") == 0
+        || strcmp(info->mnemonic, "RTI") == 0;
+}
+
+// Instructions in the block at start; last is set to the final one.
+static int recompile_length(const Recompiler *r, int start,
+        DisasmInstruction *last) {
+    int count = 0;
+    int offset = start;
+
+    while (count < RECOMPILE_MAX_BLOCK && recompile_decode(r, offset, last)) {
+        count++;
+        if (recompile_endsBlock(last)) {
+            break;
+        }
+        offset += last->length;
+    }
+
+    return count;
+}
+
+static void recompile_walk(Recompiler *r) {
+    recompile_addStart(r, 0);
+    recompile_addAddress(r, r->window[RECOMPILE_RESET_VECTOR] |
+            r->window[RECOMPILE_RESET_VECTOR + 1] << 8);
+    recompile_addAddress(r, r->window[RECOMPILE_IRQ_VECTOR] |
+            r->window[RECOMPILE_IRQ_VECTOR + 1] << 8);
+
+    while (r->pendingCount > 0) {
+        int offset = r->pending[--r->pendingCount];
+        int count = 0;
+        bool ended = false;
+        DisasmInstruction ins;
+
+        while (!ended && count < RECOMPILE_MAX_BLOCK
+                && recompile_decode(r, offset, &ins)) {
+            const OpcodeInfo *info = &disasm_opcodes[ins.opcode];
+            int next = offset + ins.length;
+
+            count++;
+            if (info->mode == MODE_RELATIVE) {
+                recompile_addStart(r, next + (int8_t) ins.operand);
+                recompile_addStart(r, next);
+            } else if (strcmp(info->mnemonic, "JSR") == 0) {
+                recompile_addAddress(r, ins.operand);
+                recompile_addStart(r, next);
+            } else if (strcmp(info->mnemonic, "JMP") == 0
+                    && info->mode == MODE_ABSOLUTE) {
+                recompile_addAddress(r, ins.operand);
+            }
+            ended = recompile_endsBlock(&ins);
+            offset = next;
+        }
+        // Split runs carry on in a block of their own.
+        if (!ended && count == RECOMPILE_MAX_BLOCK) {
+            recompile_addStart(r, offset);
+        }
+    }
+}
+
+// Loads and ALU reads pay for crossing a page when indexing; stores and
+// read-modify-write instructions always pay in their base count.
+static bool recompile_isRead(const char *mnemonic) {
+    static const char *const reads[] = {
+        "LDA", "LDX", "LDY", "ORA", "AND", "EOR", "ADC", "SBC", "CMP"
+    };
+
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        if (strcmp(mnemonic, reads[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Declares address for the memory operand of ins.
+static void recompile_address(Recompiler *r, const DisasmInstruction *ins,
+        AddressMode mode) {
+    bool read = recompile_isRead(disasm_opcodes[ins->opcode].mnemonic);
+    uint16_t operand = ins->operand;
+
+    switch (mode) {
+        case MODE_ZERO_PAGE:
+        case MODE_ABSOLUTE:
+            fprintf(r->out, "        uint16_t address = 0x%04x;\n", operand);
+            break;
+        case MODE_ZERO_PAGE_X:
+        case MODE_ZERO_PAGE_Y:
+            fprintf(r->out, "        uint16_t address = "
+                    "(uint8_t) (0x%02x + cpu->%c);\n", operand,
+                    mode == MODE_ZERO_PAGE_X ? 'x' : 'y');
+            break;
+        case MODE_ABSOLUTE_X:
+        case MODE_ABSOLUTE_Y:
+            fprintf(r->out, "        uint16_t address = "
+                    "(uint16_t) (0x%04x + cpu->%c);\n", operand,
+                    mode == MODE_ABSOLUTE_X ? 'x' : 'y');
+            if (read) {
+                fprintf(r->out, "        cpu->cycles += "
+                        "cpu_pageCrossed(0x%04x, address);\n", operand);
+            }
+            break;
+        case MODE_INDEXED_INDIRECT:
+            fprintf(r->out, "        uint8_t pointer = 0x%02x + cpu->x;\n"
+                    "        uint16_t address = cpu_toDWORD("
+                    "cpu_read(cpu, (uint8_t) (pointer + 1)), "
+                    "cpu_read(cpu, pointer));\n", operand);
+            break;
+        case MODE_INDIRECT_INDEXED:
+            fprintf(r->out, "        uint16_t base = cpu_toDWORD("
+                    "cpu_read(cpu, 0x%02x), cpu_read(cpu, 0x%02x));\n"
+                    "        uint16_t address = base + cpu->y;\n",
+                    (operand + 1) & 0xff, operand);
+            if (read) {
+                fprintf(r->out, "        cpu->cycles += "
+                        "cpu_pageCrossed(base, address);\n");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Emits the body of a non-flow instruction. Returns false for one it
+// doesn't know, which the caller leaves to the interpreter.
+static bool recompile_operation(Recompiler *r, const DisasmInstruction *ins,
+        AddressMode mode) {
+    const char *mnemonic = disasm_opcodes[ins->opcode].mnemonic;
+    FILE *out = r->out;
+    char value[32];
+    // Read-modify-write instructions work on target, A or the memory byte.
+    const char *target = mode == MODE_ACCUMULATOR ? "cpu->acc" : "value";
+
+    if (mode == MODE_IMMEDIATE) {
+        snprintf(value, sizeof(value), "0x%02x", ins->operand);
+    } else {
+        snprintf(value, sizeof(value), "cpu_read(cpu, address)");
+        recompile_address(r, ins, mode);
+    }
+
+    static const struct {
+        const char *mnemonic;
+        const char *format;
+    } simple[] = {
+        { "LDA", "cpu->acc = %s;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "LDX", "cpu->x = %s;\n        cpu_setZNFlags(cpu, cpu->x);\n" },
+        { "LDY", "cpu->y = %s;\n        cpu_setZNFlags(cpu, cpu->y);\n" },
+        { "ORA", "cpu->acc |= %s;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "AND", "cpu->acc &= %s;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "EOR", "cpu->acc ^= %s;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "ADC", "cpu_add(cpu, %s);\n" },
+        { "SBC", "cpu_subtract(cpu, %s);\n" },
+        { "CMP", "cpu_compare(cpu, cpu->acc, %s);\n" },
+        { "CPX", "cpu_compare(cpu, cpu->x, %s);\n" },
+        { "CPY", "cpu_compare(cpu, cpu->y, %s);\n" },
+        { "BIT", "cpu_bit(cpu, %s);\n" },
+    };
+    for (size_t i = 0; i < sizeof(simple) / sizeof(simple[0]); i++) {
+        if (strcmp(mnemonic, simple[i].mnemonic) == 0) {
+            fprintf(out, "        ");
+            fprintf(out, simple[i].format, value);
+            return true;
+        }
+    }
+
+    if (strcmp(mnemonic, "STA") == 0 || strcmp(mnemonic, "STX") == 0
+            || strcmp(mnemonic, "STY") == 0) {
+        const char *reg = mnemonic[2] == 'A' ? "acc"
+            : mnemonic[2] == 'X' ? "x" : "y";
+        fprintf(out, "        cpu_write(cpu, address, cpu->%s);\n", reg);
+        return true;
+    }
+
+    static const struct {
+        const char *mnemonic;
+        const char *format;
+    } rmw[] = {
+        { "ASL", "cpu_setCarry(cpu, MASK_SIGN(%1$s));\n"
+            "        %1$s <<= 1;\n" },
+        { "LSR", "cpu_setCarry(cpu, MASK_BIT0(%1$s));\n"
+            "        %1$s >>= 1;\n" },
+        { "ROL", "uint8_t carry = CPU_CARRY(cpu);\n"
+            "        cpu_setCarry(cpu, MASK_SIGN(%1$s));\n"
+            "        %1$s = (%1$s << 1) | carry;\n" },
+        { "ROR", "uint8_t carry = CPU_CARRY(cpu);\n"
+            "        cpu_setCarry(cpu, MASK_BIT0(%1$s));\n"
+            "        %1$s = (%1$s >> 1) | (carry << 7);\n" },
+        { "INC", "%1$s++;\n" },
+        { "DEC", "%1$s--;\n" },
+    };
+    for (size_t i = 0; i < sizeof(rmw) / sizeof(rmw[0]); i++) {
+        if (strcmp(mnemonic, rmw[i].mnemonic) == 0) {
+            if (mode != MODE_ACCUMULATOR) {
+                fprintf(out, "        uint8_t value = cpu_read(cpu, "
+                        "address);\n");
+            }
+            fprintf(out, "        ");
+            fprintf(out, rmw[i].format, target);
+            if (mode != MODE_ACCUMULATOR) {
+                fprintf(out, "        cpu_write(cpu, address, value);\n");
+            }
+            fprintf(out, "        cpu_setZNFlags(cpu, %s);\n", target);
+            return true;
+        }
+    }
+
+    static const struct {
+        const char *mnemonic;
+        const char *code;
+    } implied[] = {
+        { "INX", "cpu->x++;\n        cpu_setZNFlags(cpu, cpu->x);\n" },
+        { "INY", "cpu->y++;\n        cpu_setZNFlags(cpu, cpu->y);\n" },
+        { "DEX", "cpu->x--;\n        cpu_setZNFlags(cpu, cpu->x);\n" },
+        { "DEY", "cpu->y--;\n        cpu_setZNFlags(cpu, cpu->y);\n" },
+        { "TAX", "cpu->x = cpu->acc;\n        cpu_setZNFlags(cpu, cpu->x);\n" },
+        { "TAY", "cpu->y = cpu->acc;\n        cpu_setZNFlags(cpu, cpu->y);\n" },
+        { "TXA", "cpu->acc = cpu->x;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "TYA", "cpu->acc = cpu->y;\n        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "TSX", "cpu->x = cpu->sp & 0xff;\n"
+            "        cpu_setZNFlags(cpu, cpu->x);\n" },
+        { "TXS", "cpu->sp = STACK_END | cpu->x;\n" },
+        { "CLC", "cpu_setCarry(cpu, false);\n" },
+        { "SEC", "cpu_setCarry(cpu, true);\n" },
+        { "CLV", "cpu_setOverflow(cpu, false);\n" },
+        { "CLI", "cpu->p &= ~FLAG_INTERRUPT;\n" },
+        { "SEI", "cpu->p |= FLAG_INTERRUPT;\n" },
+        { "CLD", "cpu->p &= ~FLAG_DECIMAL;\n" },
+        { "SED", "cpu->p |= FLAG_DECIMAL;\n" },
+        { "PHA", "cpu_push(cpu, cpu->acc);\n" },
+        { "PHP", "cpu_push(cpu, cpu_getStatus(cpu) | FLAG_BREAK);\n" },
+        { "PLA", "cpu->acc = cpu_pull(cpu);\n"
+            "        cpu_setZNFlags(cpu, cpu->acc);\n" },
+        { "PLP", "cpu_setStatus(cpu, cpu_pull(cpu));\n" },
+        { "NOP", "" },
+    };
+    for (size_t i = 0; i < sizeof(implied) / sizeof(implied[0]); i++) {
+        if (strcmp(mnemonic, implied[i].mnemonic) == 0) {
+            if (implied[i].code[0]) {
+                fprintf(out, "        %s", implied[i].code);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Emits the instruction that ends a block, setting pc. Returns false if
+// ins doesn't end one.
+static bool recompile_flow(Recompiler *r, const DisasmInstruction *ins,
+        int offset) {
+    const OpcodeInfo *info = &disasm_opcodes[ins->opcode];
+    FILE *out = r->out;
+
+    if (info->mode == MODE_RELATIVE) {
+        static const struct {
+            const char *mnemonic;
+            const char *condition;
+        } branches[] = {
+            { "BPL", "!CPU_SIGN(cpu)" }, { "BMI", "CPU_SIGN(cpu)" },
+            { "BVC", "!CPU_OVERFLOW(cpu)" }, { "BVS", "CPU_OVERFLOW(cpu)" },
+            { "BCC", "!CPU_CARRY(cpu)" }, { "BCS", "CPU_CARRY(cpu)" },
+            { "BNE", "!CPU_ZERO(cpu)" }, { "BEQ", "CPU_ZERO(cpu)" },
+        };
+        const char *condition = NULL;
+
+        for (size_t i = 0; i < sizeof(branches) / sizeof(branches[0]); i++) {
+            if (strcmp(info->mnemonic, branches[i].mnemonic) == 0) {
+                condition = branches[i].condition;
+            }
+        }
+        fprintf(out, "        uint16_t next = pc + %d;\n", offset + 2);
+        fprintf(out, "        if (%s) {\n"
+                "            uint16_t target = next + %d;\n"
+                "            cpu->cycles += 1 + cpu_pageCrossed(next, "
+                "target);\n"
+                "            cpu->pc = target;\n"
+                "        } else {\n"
+                "            cpu->pc = next;\n"
+                "        }\n", condition, (int8_t) ins->operand);
+    } else if (strcmp(info->mnemonic, "JMP") == 0) {
+        if (info->mode == MODE_ABSOLUTE) {
+            fprintf(out, "        cpu->pc = 0x%04x;\n", ins->operand);
+        } else {
+            uint16_t next = (ins->operand & 0xff00)
+                | ((ins->operand + 1) & 0x00ff);
+            fprintf(out, "        cpu->pc = cpu_toDWORD(cpu_read(cpu, "
+                    "0x%04x), cpu_read(cpu, 0x%04x));\n", next,
+                    ins->operand);
+        }
+    } else if (strcmp(info->mnemonic, "JSR") == 0) {
+        fprintf(out, "        uint16_t last = pc + %d;\n"
+                "        cpu_push(cpu, cpu_higherByte(last));\n"
+                "        cpu_push(cpu, cpu_lowerByte(last));\n"
+                "        cpu->pc = 0x%04x;\n", offset + 2, ins->operand);
+    } else if (strcmp(info->mnemonic, "RTS") == 0) {
+        fprintf(out, "        uint16_t address = cpu_pull(cpu);\n"
+                "        address |= cpu_pull(cpu) << 8;\n"
+                "        cpu->pc = address + 1;\n");
+    } else if (strcmp(info->mnemonic, "RTI") == 0) {
+        fprintf(out, "        cpu_setStatus(cpu, cpu_pull(cpu));\n"
+                "        uint8_t l = cpu_pull(cpu);\n"
+                "        uint8_t h = cpu_pull(cpu);\n"
+                "        cpu->pc = cpu_toDWORD(h, l);\n");
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the block starting at start as recompiled_xxxx, one scope per
+// instruction. pc is wherever the block was entered, so the same code runs
+// in any mirror of the window. Returns the number of instructions.
+static int recompile_block(Recompiler *r, int start) {
+    FILE *out = r->out;
+    int offset = start;
+    int count = 0;
+    bool ended = false;
+    DisasmInstruction ins;
+
+    // Blocks ending in JMP, RTS or RTI don't need to know where they are.
+    fprintf(out, "static void recompiled_%04x(Cpu *cpu) {\n",
+            ROM_START + start);
+    recompile_length(r, start, &ins);
+    const char *last = disasm_opcodes[ins.opcode].mnemonic;
+    if (!recompile_endsBlock(&ins) || (strcmp(last, "JMP") != 0
+                && strcmp(last, "RTS") != 0 && strcmp(last, "RTI") != 0)) {
+        fprintf(out, "    uint16_t pc = cpu->pc;\n\n");
+    }
+
+    while (count < RECOMPILE_MAX_BLOCK && recompile_decode(r, offset, &ins)) {
+        const OpcodeInfo *info = &disasm_opcodes[ins.opcode];
+        char text[DISASM_TEXT_SIZE];
+
+        disasm_format(&ins, text);
+        fprintf(out, "    // $%04x  %s\n    {\n"
+                "        cpu->cycles += %d;\n", ins.address, text,
+                info->cycles);
+        if (recompile_endsBlock(&ins)) {
+            recompile_flow(r, &ins, offset - start);
+            fprintf(out, "    }\n");
+            ended = true;
+            count++;
+            break;
+        }
+        if (!recompile_operation(r, &ins, info->mode)) {
+            fprintf(stderr, "recompile: no translation for %s at $%04x\n",
+                    info->mnemonic, ins.address);
+            exit(1);
+        }
+        fprintf(out, "    }\n");
+        offset += ins.length;
+        count++;
+    }
+    if (!ended) {
+        fprintf(out, "    cpu->pc = pc + %d;\n", offset - start);
+    }
+    fprintf(out, "}\n\n");
+
+    return count;
+}
+
+static void recompile_header(Recompiler *r, const char *path) {
+    fprintf(r->out, "/*\n * Generated by recompile from %s. Do not edit.\n"
+            " */\n#include \"cpu.c\"\n#include \"recompiled.h\"\n\n", path);
+
+    fprintf(r->out, "static const byte recompiled_image[%d] = {",
+            RECOMPILE_WINDOW);
+    for (int i = 0; i < RECOMPILE_WINDOW; i++) {
+        fprintf(r->out, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ",
+                r->window[i]);
+    }
+    fprintf(r->out, "\n};\n\n");
+}
+
+// The blocks are indexed by offset into the window, so recompiled_run
+// finds one with a single lookup.
+static void recompile_table(Recompiler *r) {
+    fprintf(r->out, "static const RecompiledBlock recompiled_blocks[%d] = "
+            "{\n", RECOMPILE_WINDOW);
+    for (int offset = 0; offset < RECOMPILE_WINDOW; offset++) {
+        if (r->counts[offset] > 0) {
+            fprintf(r->out, "    [0x%03x] = { %d, recompiled_%04x },\n",
+                    offset, r->counts[offset], ROM_START + offset);
+        }
+    }
+    fprintf(r->out, "};\n\n"
+            "const RecompiledProgram recompiled_program = {\n"
+            "    recompiled_image, recompiled_blocks\n};\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s rom\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    Recompiler *r = calloc(1, sizeof(Recompiler));
+    byte rom[RECOMPILE_WINDOW + 1];
+    size_t size = fread(rom, 1, sizeof(rom), f);
+    fclose(f);
+    if (size == 0 || size > RECOMPILE_WINDOW) {
+        fprintf(stderr, "%s: only unbanked images of up to 4K can be "
+                "recompiled\n", argv[1]);
+        free(r);
+        return 1;
+    }
+
+    // Lay the window out the way cpu_loadRom does.
+    if (RECOMPILE_WINDOW % size == 0) {
+        for (size_t offset = 0; offset < RECOMPILE_WINDOW; offset += size) {
+            memcpy(&r->window[offset], rom, size);
+        }
+    } else {
+        memcpy(r->window, rom, size);
+    }
+    r->out = stdout;
+
+    recompile_walk(r);
+    recompile_header(r, argv[1]);
+    int blocks = 0;
+    for (int offset = 0; offset < RECOMPILE_WINDOW; offset++) {
+        DisasmInstruction ins;
+
+        if (r->starts[offset] && recompile_decode(r, offset, &ins)) {
+            r->counts[offset] = recompile_block(r, offset);
+            blocks++;
+        }
+    }
+    recompile_table(r);
+    fprintf(stderr, "%s: %d blocks\n", argv[1], blocks);
+
+    free(r);
+
+    return 0;
+}
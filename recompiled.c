@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "recompiled.h"
+
+bool recompiled_attach(const RecompiledProgram *program, const Cpu *cpu) {
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        uint16_t address = (i << 8) & ADDRESS_MASK;
+        const Page *page = &cpu->pages[i];
+
+        if (!(address & ROM_START)) {
+            continue;
+        }
+        if (!page->read || page->write || page->trapped
+                || memcmp(page->read,
+                    program->image + (address & (RECOMPILED_WINDOW - 1)),
+                    PAGE_SIZE) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t recompiled_run(Cpu *cpu, const RecompiledProgram *program,
+        uint64_t maxInstructions, CpuStopReason *stopReason) {
+    CpuStopReason stop = CPU_STOP_NONE;
+    uint64_t executed = 0;
+
+    if (cpu->traceHook || cpu->breakpointCount > 0) {
+        return cpu_run(cpu, maxInstructions, CPU_RUN_UNLIMITED, stopReason);
+    }
+
+    while (executed < maxInstructions) {
+        const RecompiledBlock *block =
+            &program->blocks[cpu->pc & (RECOMPILED_WINDOW - 1)];
+
+        if ((cpu->pc & ROM_START) && block->run
+                && block->instructions <= maxInstructions - executed) {
+            block->run(cpu);
+            executed += block->instructions;
+            continue;
+        }
+
+        // One instruction at a time, so a block that would overrun the
+        // limit is finished exactly.
+        executed += cpu_run(cpu, 1, CPU_RUN_UNLIMITED, &stop);
+        if (stop == CPU_STOP_BRK || stop == CPU_STOP_ILLEGAL) {
+            break;
+        }
+        stop = CPU_STOP_NONE;
+    }
+
+    if (stop == CPU_STOP_NONE) {
+        stop = CPU_STOP_INSTRUCTIONS;
+    }
+    if (stopReason) {
+        *stopReason = stop;
+    }
+    return executed;
+}
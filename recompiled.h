@@ -0,0 +1,37 @@
+#ifndef RECOMPILED_H_INCLUDED_
+#define RECOMPILED_H_INCLUDED_
+
+#include "cpu.h"
+
+#define RECOMPILED_WINDOW (ROM_END - ROM_START + 1)
+
+// One basic block of a ROM translated to C by recompile. run executes all
+// of its instructions, cycles included, and leaves pc at the next one.
+// Blocks only use pc-relative addresses for their own code, so one block
+// serves every mirror of the ROM window.
+typedef struct _recompiledBlock {
+    uint32_t instructions;
+    void (*run)(Cpu *cpu);
+} RecompiledBlock;
+
+// What a generated file exports as recompiled_program: the window as it
+// was compiled and a block for every offset in it that starts one.
+typedef struct _recompiledProgram {
+    const byte *image;
+    const RecompiledBlock *blocks;
+} RecompiledProgram;
+
+extern const RecompiledProgram recompiled_program;
+
+// Whether every page of cpu that the ROM window maps to is read-only and
+// holds the compiled image, which is what running blocks relies on.
+bool recompiled_attach(const RecompiledProgram *program, const Cpu *cpu);
+// cpu_run for a Cpu that passed recompiled_attach: compiled blocks run
+// whole, anything else (code in RAM, BRK, targets the walk didn't find)
+// goes through the interpreter. Stops like cpu_run, after exactly
+// maxInstructions at most; with breakpoints or a trace hook set it is
+// cpu_run.
+uint64_t recompiled_run(Cpu *cpu, const RecompiledProgram *program,
+        uint64_t maxInstructions, CpuStopReason *stopReason);
+
+#endif /* RECOMPILED_H_INCLUDED_ */
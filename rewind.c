@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+#define REWIND_PAGES (MAX_MEMORY / PAGE_SIZE)
+#define REWIND_ALIGN(size) (((size) + 7) & ~(size_t) 7)
+
+// Header of one recorded point. Its deltas follow directly in the ring.
+typedef struct _rewindPoint {
+    size_t size;
+    size_t previous;
+    size_t next;
+    uint64_t cycles;
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t status;
+    uint8_t device[CPU_DEVICE_STATE_SIZE];
+    int pageCount;
+} RewindPoint;
+
+typedef struct _rewindDelta {
+    uint8_t page;
+    uint8_t data[PAGE_SIZE];
+} RewindDelta;
+
+struct _rewindBuffer {
+    Cpu *cpu;
+    // The Cpu as of the point it's at, to diff the next one against.
+    CpuSnapshot *current;
+    uint8_t *ring;
+    size_t capacity;
+    size_t first;
+    size_t last;
+    size_t count;
+    size_t position;
+    size_t positionOffset;
+    RewindDelta scratch[REWIND_PAGES];
+};
+
+static inline RewindPoint *rewind_point(RewindBuffer *rewind, size_t offset);
+static void rewind_evictOldest(RewindBuffer *rewind);
+static void rewind_evictBetween(RewindBuffer *rewind, size_t start,
+        size_t end);
+static size_t rewind_place(RewindBuffer *rewind, size_t size);
+static void rewind_applyDeltas(Cpu *cpu, const RewindPoint *point);
+
+static inline RewindPoint *rewind_point(RewindBuffer *rewind, size_t offset) {
+    return (RewindPoint *) (rewind->ring + offset);
+}
+
+static void rewind_evictOldest(RewindBuffer *rewind) {
+    rewind->first = rewind_point(rewind, rewind->first)->next;
+    rewind->count--;
+}
+
+static void rewind_evictBetween(RewindBuffer *rewind, size_t start,
+        size_t end) {
+    while (rewind->count && rewind->first >= start && rewind->first < end) {
+        rewind_evictOldest(rewind);
+    }
+}
+
+// Finds room for a point of the given size right after the newest one,
+// wrapping to the start of the ring when it doesn't fit before the end.
+// Whatever lies in the way is the oldest history and is evicted.
+static size_t rewind_place(RewindBuffer *rewind, size_t size) {
+    if (!rewind->count) {
+        return 0;
+    }
+
+    size_t end = rewind->last + rewind_point(rewind, rewind->last)->size;
+    if (end + size <= rewind->capacity) {
+        rewind_evictBetween(rewind, end, end + size);
+        return end;
+    }
+
+    rewind_evictBetween(rewind, end, rewind->capacity);
+    rewind_evictBetween(rewind, 0, size);
+    return 0;
+}
+
+// XOR deltas go both ways: applied to a point they give the one before it,
+// applied to the one before they give it back.
+static void rewind_applyDeltas(Cpu *cpu, const RewindPoint *point) {
+    const RewindDelta *deltas = (const RewindDelta *) (point + 1);
+
+    for (int i = 0; i < point->pageCount; i++) {
+        uint8_t *page = &cpu->memory[deltas[i].page * PAGE_SIZE];
+
+        for (int j = 0; j < PAGE_SIZE; j++) {
+            page[j] ^= deltas[i].data[j];
+        }
+        cpu->snapshotDirty[deltas[i].page] = 1;
+    }
+    if (point->pageCount > 0) {
+        cpu_flushBlocks(cpu);
+    }
+}
+
+RewindBuffer *rewind_create(Cpu *cpu, size_t budget) {
+    RewindBuffer *rewind = calloc(1, sizeof(RewindBuffer));
+    if (!rewind) {
+        return NULL;
+    }
+
+    rewind->cpu = cpu;
+    rewind->capacity = budget & ~(size_t) 7;
+    rewind->ring = malloc(rewind->capacity ? rewind->capacity : 1);
+
+    // Point 0 is wherever the Cpu is now.
+    if (!rewind->ring || rewind_record(rewind) < 0) {
+        rewind_free(rewind);
+        return NULL;
+    }
+
+    return rewind;
+}
+
+void rewind_free(RewindBuffer *rewind) {
+    if (!rewind) {
+        return;
+    }
+
+    cpu_freeSnapshot(rewind->current);
+    free(rewind->ring);
+    free(rewind);
+}
+
+int rewind_record(RewindBuffer *rewind) {
+    Cpu *cpu = rewind->cpu;
+    int pageCount = 0;
+
+    if (rewind->current) {
+        for (int i = 0; i < REWIND_PAGES; i++) {
+            if (!cpu_snapshotPageChanged(cpu, rewind->current, i)) {
+                continue;
+            }
+
+            const uint8_t *then = cpu_snapshotPageData(rewind->current, i);
+            const uint8_t *now = &cpu->memory[i * PAGE_SIZE];
+            RewindDelta *delta = &rewind->scratch[pageCount];
+            uint8_t changed = 0;
+
+            for (int j = 0; j < PAGE_SIZE; j++) {
+                delta->data[j] = then[j] ^ now[j];
+                changed |= delta->data[j];
+            }
+            if (changed) {
+                delta->page = i;
+                pageCount++;
+            }
+        }
+    }
+
+    size_t size = REWIND_ALIGN(sizeof(RewindPoint)
+            + pageCount * sizeof(RewindDelta));
+    if (size > rewind->capacity) {
+        return -1;
+    }
+
+    CpuSnapshot *snapshot = cpu_snapshot(cpu);
+    if (!snapshot) {
+        return -1;
+    }
+
+    // Recording after seeking back forgets the points that came after.
+    if (rewind->count) {
+        rewind->count = rewind->position + 1;
+        rewind->last = rewind->positionOffset;
+    }
+
+    size_t offset = rewind_place(rewind, size);
+    RewindPoint *point = rewind_point(rewind, offset);
+
+    point->size = size;
+    point->cycles = cpu->cycles;
+    point->sp = cpu->sp;
+    point->pc = cpu->pc;
+    point->acc = cpu->acc;
+    point->x = cpu->x;
+    point->y = cpu->y;
+    point->status = cpu_getStatus(cpu);
+    cpu_saveDeviceState(cpu, point->device);
+    point->pageCount = pageCount;
+    memcpy(point + 1, rewind->scratch, pageCount * sizeof(RewindDelta));
+
+    if (rewind->count) {
+        point->previous = rewind->last;
+        rewind_point(rewind, rewind->last)->next = offset;
+    } else {
+        rewind->first = offset;
+    }
+    rewind->last = offset;
+    rewind->position = rewind->count++;
+    rewind->positionOffset = offset;
+
+    cpu_freeSnapshot(rewind->current);
+    rewind->current = snapshot;
+
+    return 0;
+}
+
+int rewind_seek(RewindBuffer *rewind, size_t index) {
+    Cpu *cpu = rewind->cpu;
+    size_t offset = rewind->positionOffset;
+
+    if (index >= rewind->count) {
+        return -1;
+    }
+
+    // Drop whatever ran since the last record or seek, so memory matches
+    // the point the deltas are relative to.
+    cpu_restore(cpu, rewind->current);
+
+    while (rewind->position > index) {
+        RewindPoint *point = rewind_point(rewind, offset);
+
+        rewind_applyDeltas(cpu, point);
+        offset = point->previous;
+        rewind->position--;
+    }
+    while (rewind->position < index) {
+        offset = rewind_point(rewind, offset)->next;
+        rewind_applyDeltas(cpu, rewind_point(rewind, offset));
+        rewind->position++;
+    }
+    rewind->positionOffset = offset;
+
+    const RewindPoint *point = rewind_point(rewind, offset);
+    cpu->acc = point->acc;
+    cpu->x = point->x;
+    cpu->y = point->y;
+    cpu_setStatus(cpu, point->status);
+    cpu->sp = point->sp;
+    cpu->pc = point->pc;
+    cpu->cycles = point->cycles;
+    cpu_loadDeviceState(cpu, point->device);
+
+    CpuSnapshot *snapshot = cpu_snapshot(cpu);
+    if (!snapshot) {
+        return -1;
+    }
+    cpu_freeSnapshot(rewind->current);
+    rewind->current = snapshot;
+
+    return 0;
+}
+
+size_t rewind_count(const RewindBuffer *rewind) {
+    return rewind->count;
+}
+
+size_t rewind_position(const RewindBuffer *rewind) {
+    return rewind->position;
+}
+
+// Runs like cpu_run without a cycle limit, recording a point every
+// interval instructions and once more where it stops. A point that can't
+// be recorded stops the run right there and returns -1; executed and
+// stopReason still say how far it got.
+int rewind_run(RewindBuffer *rewind, uint64_t maxInstructions,
+        uint64_t interval, uint64_t *executed, CpuStopReason *stopReason) {
+    CpuStopReason stop = CPU_STOP_INSTRUCTIONS;
+    uint64_t done = 0;
+    int result = 0;
+
+    if (interval == 0) {
+        interval = maxInstructions;
+    }
+
+    while (done < maxInstructions) {
+        uint64_t slice = maxInstructions - done;
+
+        if (slice > interval) {
+            slice = interval;
+        }
+        done += cpu_run(rewind->cpu, slice, CPU_RUN_UNLIMITED, &stop);
+        if (rewind_record(rewind) < 0) {
+            result = -1;
+            break;
+        }
+        if (stop != CPU_STOP_INSTRUCTIONS) {
+            break;
+        }
+    }
+
+    if (executed) {
+        *executed = done;
+    }
+    if (stopReason) {
+        *stopReason = stop;
+    }
+    return result;
+}
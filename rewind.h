@@ -0,0 +1,33 @@
+#ifndef REWIND_H_INCLUDED_
+#define REWIND_H_INCLUDED_
+
+#include "cpu.h"
+#include "snapshot.h"
+
+// Records the state of one Cpu at points chosen by the caller (every frame,
+// every N instructions) and moves it back and forth between them.
+//
+// Each recorded point stores the registers plus the XOR of every page of
+// memory[] that changed since the point before, which serves both to undo
+// and to redo it. Points live back to back in a ring of a fixed number of
+// bytes; recording a point that doesn't fit evicts the oldest ones, so a
+// long run keeps as much recent history as the budget allows and never
+// more. Changed pages are found through the Cpu's snapshot write traps, so
+// a point costs only the pages actually written since the last one.
+//
+// Seeking back and then recording again drops the points after the current
+// one, like an undo stack.
+typedef struct _rewindBuffer RewindBuffer;
+
+RewindBuffer *rewind_create(Cpu *cpu, size_t budget);
+void rewind_free(RewindBuffer *rewind);
+int rewind_record(RewindBuffer *rewind);
+int rewind_seek(RewindBuffer *rewind, size_t index);
+size_t rewind_count(const RewindBuffer *rewind);
+size_t rewind_position(const RewindBuffer *rewind);
+// Fails, stopping early, when a point doesn't fit the budget or its
+// snapshot can't be allocated, rather than silently losing history.
+int rewind_run(RewindBuffer *rewind, uint64_t maxInstructions,
+        uint64_t interval, uint64_t *executed, CpuStopReason *stopReason);
+
+#endif /* REWIND_H_INCLUDED_ */
@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+
+// Page of the window that holds the hotspots, relative to ROM_START.
+#define ROM_HOTSPOT_PAGE 0xf00
+
+static bool rom_mirrored(size_t size);
+static void rom_mapWindow(Rom *rom, Cpu *cpu, bool hotspots);
+static uint8_t rom_hotspotRead(Cpu *cpu, uint16_t address, void *context);
+static void rom_hotspotWrite(Cpu *cpu, uint16_t address, uint8_t value,
+        void *context);
+static void rom_touch(Rom *rom, Cpu *cpu, uint16_t address);
+static void rom_saveState(const Cpu *cpu, uint8_t *state, void *context);
+static void rom_loadState(Cpu *cpu, const uint8_t *state, void *context);
+
+// Whole pages that tile the window evenly can be mapped in place.
+static bool rom_mirrored(size_t size) {
+    return size >= PAGE_SIZE && size <= ROM_WINDOW_SIZE
+        && (size & (size - 1)) == 0;
+}
+
+int rom_open(Rom *rom, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    rom->size = st.st_size;
+    rom->banking = ROM_BANKING_NONE;
+    rom->bankCount = 1;
+    rom->firstHotspot = 0;
+
+    switch (rom->size) {
+        case 2 * ROM_WINDOW_SIZE:
+            rom->banking = ROM_BANKING_F8;
+            rom->bankCount = 2;
+            rom->firstHotspot = 0xff8;
+            break;
+        case 4 * ROM_WINDOW_SIZE:
+            rom->banking = ROM_BANKING_F6;
+            rom->bankCount = 4;
+            rom->firstHotspot = 0xff6;
+            break;
+        case 8 * ROM_WINDOW_SIZE:
+            rom->banking = ROM_BANKING_F4;
+            rom->bankCount = 8;
+            rom->firstHotspot = 0xff4;
+            break;
+        default:
+            if (rom->size == 0 || rom->size > ROM_WINDOW_SIZE) {
+                close(fd);
+                errno = EINVAL;
+                return -1;
+            }
+            break;
+    }
+
+    void *data = mmap(NULL, rom->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    rom->data = data;
+    // Carts are commonly built to boot from the last bank.
+    rom->bank = rom->bankCount - 1;
+
+    return 0;
+}
+
+void rom_close(Rom *rom) {
+    munmap((void *) rom->data, rom->size);
+    rom->data = NULL;
+}
+
+// Points every ROM page of the 2600 map at the current bank. The pages
+// holding the hotspots go through handlers instead, so touching them can
+// switch banks. The pages change one at a time but flush once.
+static void rom_mapWindow(Rom *rom, Cpu *cpu, bool hotspots) {
+    const byte *bank = rom->data + rom->bank * ROM_WINDOW_SIZE;
+    size_t size = rom->size < ROM_WINDOW_SIZE ? rom->size : ROM_WINDOW_SIZE;
+
+    cpu_beginMapping(cpu);
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        uint16_t address = (i << 8) & ADDRESS_MASK;
+        uint16_t offset = address & (ROM_WINDOW_SIZE - 1);
+
+        if (!(address & ROM_START)) {
+            continue;
+        }
+        if (hotspots && offset == ROM_HOTSPOT_PAGE) {
+            cpu_mapDevice(cpu, i, 1, rom_hotspotRead, rom_hotspotWrite, rom);
+        } else {
+            cpu_mapMemory(cpu, i, 1, (uint8_t *) bank + (offset & (size - 1)),
+                    false);
+        }
+    }
+    cpu_endMapping(cpu);
+}
+
+int rom_map(Rom *rom, Cpu *cpu) {
+    if (rom->banking == ROM_BANKING_NONE && !rom_mirrored(rom->size)) {
+        return cpu_loadRom(cpu, rom->data, rom->size);
+    }
+
+    rom_mapWindow(rom, cpu, rom->banking != ROM_BANKING_NONE);
+    if (rom->banking != ROM_BANKING_NONE) {
+        cpu_setDeviceState(cpu, rom_saveState, rom_loadState, rom);
+    }
+    return 0;
+}
+
+void rom_selectBank(Rom *rom, Cpu *cpu, int bank) {
+    if (bank == rom->bank || bank < 0 || bank >= rom->bankCount) {
+        return;
+    }
+
+    rom->bank = bank;
+    rom_mapWindow(rom, cpu, true);
+}
+
+static void rom_touch(Rom *rom, Cpu *cpu, uint16_t address) {
+    uint16_t offset = address & (ROM_WINDOW_SIZE - 1);
+
+    if (offset >= rom->firstHotspot
+            && offset < rom->firstHotspot + rom->bankCount) {
+        rom_selectBank(rom, cpu, offset - rom->firstHotspot);
+    }
+}
+
+// Reads see the newly selected bank, as on the real cartridge.
+static uint8_t rom_hotspotRead(Cpu *cpu, uint16_t address, void *context) {
+    Rom *rom = context;
+
+    rom_touch(rom, cpu, address);
+    return rom->data[rom->bank * ROM_WINDOW_SIZE
+        + (address & (ROM_WINDOW_SIZE - 1))];
+}
+
+static void rom_hotspotWrite(Cpu *cpu, uint16_t address, uint8_t value,
+        void *context) {
+    (void) value;
+    rom_touch(context, cpu, address);
+}
+
+static void rom_saveState(const Cpu *cpu, uint8_t *state, void *context) {
+    const Rom *rom = context;
+
+    (void) cpu;
+    state[0] = rom->bank;
+}
+
+static void rom_loadState(Cpu *cpu, const uint8_t *state, void *context) {
+    rom_selectBank(context, cpu, state[0]);
+}
@@ -0,0 +1,42 @@
+#ifndef ROM_H_INCLUDED_
+#define ROM_H_INCLUDED_
+
+#include "cpu.h"
+
+#define ROM_WINDOW_SIZE (ROM_END - ROM_START + 1)
+
+// Atari bank switching for images larger than the 4K window: touching one
+// of the hotspot addresses at the top of the window swaps which 4K bank
+// the whole window shows.
+typedef enum _romBanking {
+    ROM_BANKING_NONE,
+    ROM_BANKING_F8,
+    ROM_BANKING_F6,
+    ROM_BANKING_F4
+} RomBanking;
+
+// A cartridge image mapped read-only from its file. The Cpu reads it in
+// place, so the Rom has to outlive every Cpu it's mapped into.
+//
+// Accepted sizes are 2K and 4K, which fill the window (2K mirrored), 8K,
+// 16K and 32K, bank switched as F8, F6 and F4, and anything smaller that
+// fits in the window. Power-of-two images of at least a page are mirrored
+// like 2K ones; other small images are copied into Cpu.memory instead,
+// since the bus maps whole pages. The selected bank is device state:
+// rom_map registers it with the Cpu, so snapshots and rewind bring it
+// back.
+typedef struct _rom {
+    const byte *data;
+    size_t size;
+    RomBanking banking;
+    int bankCount;
+    int bank;
+    uint16_t firstHotspot;
+} Rom;
+
+int rom_open(Rom *rom, const char *path);
+void rom_close(Rom *rom);
+int rom_map(Rom *rom, Cpu *cpu);
+void rom_selectBank(Rom *rom, Cpu *cpu, int bank);
+
+#endif /* ROM_H_INCLUDED_ */
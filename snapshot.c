@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_PAGES (MAX_MEMORY / PAGE_SIZE)
+// Magic, version, then A X Y P, SP, PC, the cycle count and the device
+// state.
+#define SNAPSHOT_HEADER_SIZE (8 + 2 + 4 + 2 + 2 + 8 + CPU_DEVICE_STATE_SIZE)
+
+typedef struct _snapshotPage {
+    int references;
+    uint8_t data[PAGE_SIZE];
+} SnapshotPage;
+
+struct _cpuSnapshot {
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t status;
+    uint16_t sp;
+    uint16_t pc;
+    uint64_t cycles;
+    uint8_t device[CPU_DEVICE_STATE_SIZE];
+    SnapshotPage *pages[SNAPSHOT_PAGES];
+};
+
+static SnapshotPage *snapshot_newPage(const uint8_t *data);
+static SnapshotPage *snapshot_retain(SnapshotPage *page);
+static void snapshot_release(SnapshotPage *page);
+static void snapshot_share(Cpu *cpu, SnapshotPage *const *pages);
+static void snapshot_armTraps(Cpu *cpu);
+static void snapshot_putWord(byte *buffer, uint64_t value, int size);
+static uint64_t snapshot_getWord(const byte *buffer, int size);
+
+static SnapshotPage *snapshot_newPage(const uint8_t *data) {
+    SnapshotPage *page = malloc(sizeof(SnapshotPage));
+    if (!page) {
+        return NULL;
+    }
+
+    page->references = 1;
+    memcpy(page->data, data, PAGE_SIZE);
+    return page;
+}
+
+static SnapshotPage *snapshot_retain(SnapshotPage *page) {
+    page->references++;
+    return page;
+}
+
+static void snapshot_release(SnapshotPage *page) {
+    if (page && --page->references == 0) {
+        free(page);
+    }
+}
+
+// Makes pages the Cpu's new baseline: memory[] now matches them exactly.
+static void snapshot_share(Cpu *cpu, SnapshotPage *const *pages) {
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        SnapshotPage *old = cpu->snapshotPages[i];
+
+        cpu->snapshotPages[i] = snapshot_retain(pages[i]);
+        snapshot_release(old);
+    }
+    memset(cpu->snapshotDirty, 0, sizeof(cpu->snapshotDirty));
+    snapshot_armTraps(cpu);
+}
+
+static void snapshot_armTraps(Cpu *cpu) {
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        const uint8_t *write = cpu->pages[i].write;
+
+        if (write >= cpu->memory && write < cpu->memory + MAX_MEMORY) {
+            cpu_armWriteTrap(cpu, i);
+        }
+    }
+}
+
+CpuSnapshot *cpu_snapshot(Cpu *cpu) {
+    CpuSnapshot *snapshot = calloc(1, sizeof(CpuSnapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+
+    snapshot->acc = cpu->acc;
+    snapshot->x = cpu->x;
+    snapshot->y = cpu->y;
+    snapshot->status = cpu_getStatus(cpu);
+    snapshot->sp = cpu->sp;
+    snapshot->pc = cpu->pc;
+    snapshot->cycles = cpu->cycles;
+    cpu_saveDeviceState(cpu, snapshot->device);
+
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        SnapshotPage *shared = cpu->snapshotPages[i];
+
+        if (shared && !cpu->snapshotDirty[i]) {
+            snapshot->pages[i] = snapshot_retain(shared);
+        } else {
+            snapshot->pages[i] = snapshot_newPage(
+                    &cpu->memory[i * PAGE_SIZE]);
+            if (!snapshot->pages[i]) {
+                cpu_freeSnapshot(snapshot);
+                return NULL;
+            }
+        }
+    }
+
+    snapshot_share(cpu, snapshot->pages);
+    return snapshot;
+}
+
+void cpu_restore(Cpu *cpu, const CpuSnapshot *snapshot) {
+    bool changed = false;
+
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        if (cpu_snapshotPageChanged(cpu, snapshot, i)) {
+            memcpy(&cpu->memory[i * PAGE_SIZE], snapshot->pages[i]->data,
+                    PAGE_SIZE);
+            changed = true;
+        }
+    }
+    if (changed) {
+        cpu_flushBlocks(cpu);
+    }
+
+    cpu->acc = snapshot->acc;
+    cpu->x = snapshot->x;
+    cpu->y = snapshot->y;
+    cpu_setStatus(cpu, snapshot->status);
+    cpu->sp = snapshot->sp;
+    cpu->pc = snapshot->pc;
+    cpu->cycles = snapshot->cycles;
+    // After memory, so remapping doesn't make the copy above redo every
+    // page; the mapping's own invalidation is undone by sharing below.
+    cpu_loadDeviceState(cpu, snapshot->device);
+
+    snapshot_share(cpu, snapshot->pages);
+}
+
+void cpu_freeSnapshot(CpuSnapshot *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        snapshot_release(snapshot->pages[i]);
+    }
+    free(snapshot);
+}
+
+bool cpu_snapshotPageChanged(const Cpu *cpu, const CpuSnapshot *snapshot,
+        int page) {
+    return cpu->snapshotDirty[page]
+        || cpu->snapshotPages[page] != snapshot->pages[page];
+}
+
+const uint8_t *cpu_snapshotPageData(const CpuSnapshot *snapshot, int page) {
+    return snapshot->pages[page]->data;
+}
+
+void cpu_releaseSnapshots(Cpu *cpu) {
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        snapshot_release(cpu->snapshotPages[i]);
+        cpu->snapshotPages[i] = NULL;
+    }
+    cpu_disarmWriteTraps(cpu);
+}
+
+// The file format is little-endian regardless of the host.
+static void snapshot_putWord(byte *buffer, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        buffer[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t snapshot_getWord(const byte *buffer, int size) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t) buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+int cpu_saveSnapshot(const CpuSnapshot *snapshot, FILE *f) {
+    byte header[SNAPSHOT_HEADER_SIZE];
+
+    memcpy(header, SNAPSHOT_MAGIC, 8);
+    snapshot_putWord(header + 8, SNAPSHOT_VERSION, 2);
+    header[10] = snapshot->acc;
+    header[11] = snapshot->x;
+    header[12] = snapshot->y;
+    header[13] = snapshot->status;
+    snapshot_putWord(header + 14, snapshot->sp, 2);
+    snapshot_putWord(header + 16, snapshot->pc, 2);
+    snapshot_putWord(header + 18, snapshot->cycles, 8);
+    memcpy(header + 26, snapshot->device, CPU_DEVICE_STATE_SIZE);
+
+    if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) {
+        return -1;
+    }
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        if (fwrite(snapshot->pages[i]->data, 1, PAGE_SIZE, f) != PAGE_SIZE) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+CpuSnapshot *cpu_loadSnapshot(FILE *f) {
+    byte header[SNAPSHOT_HEADER_SIZE];
+
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)
+            || memcmp(header, SNAPSHOT_MAGIC, 8) != 0
+            || snapshot_getWord(header + 8, 2) != SNAPSHOT_VERSION) {
+        return NULL;
+    }
+
+    CpuSnapshot *snapshot = calloc(1, sizeof(CpuSnapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+
+    snapshot->acc = header[10];
+    snapshot->x = header[11];
+    snapshot->y = header[12];
+    snapshot->status = header[13];
+    snapshot->sp = snapshot_getWord(header + 14, 2);
+    snapshot->pc = snapshot_getWord(header + 16, 2);
+    snapshot->cycles = snapshot_getWord(header + 18, 8);
+    memcpy(snapshot->device, header + 26, CPU_DEVICE_STATE_SIZE);
+
+    for (int i = 0; i < SNAPSHOT_PAGES; i++) {
+        uint8_t data[PAGE_SIZE];
+
+        if (fread(data, 1, PAGE_SIZE, f) != PAGE_SIZE
+                || !(snapshot->pages[i] = snapshot_newPage(data))) {
+            cpu_freeSnapshot(snapshot);
+            return NULL;
+        }
+    }
+
+    return snapshot;
+}
@@ -0,0 +1,40 @@
+#ifndef SNAPSHOT_H_INCLUDED_
+#define SNAPSHOT_H_INCLUDED_
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define SNAPSHOT_MAGIC "6502SNAP"
+#define SNAPSHOT_VERSION 2
+
+// Registers, cycle count, the whole of Cpu.memory and the device state
+// (see cpu_setDeviceState) at one point in time. The memory map, devices,
+// breakpoints and trace hook are configuration rather than state: a
+// snapshot is restored into a Cpu mapped the same way as the one it was
+// taken from, and its devices remap themselves from their state.
+//
+// Snapshots of the same Cpu share every 256-byte page that didn't change
+// between them. After a snapshot or restore the Cpu arms a write trap on
+// each writable page of memory[]; the first write to a page marks it dirty
+// and disarms the trap, so tracking costs nothing on later writes. Taking
+// or restoring a snapshot then only copies the dirty pages. Writes that
+// bypass cpu_write (poking Cpu.memory directly) are not seen, and device
+// or externally mapped memory is not part of the snapshot.
+typedef struct _cpuSnapshot CpuSnapshot;
+
+CpuSnapshot *cpu_snapshot(Cpu *cpu);
+void cpu_restore(Cpu *cpu, const CpuSnapshot *snapshot);
+void cpu_freeSnapshot(CpuSnapshot *snapshot);
+// Drops the pages the Cpu keeps for sharing and disarms its write traps.
+// Call before discarding or reinitializing a Cpu that took snapshots.
+void cpu_releaseSnapshots(Cpu *cpu);
+// Whether a page of memory[] may differ from the snapshot, without comparing
+// bytes: false means it certainly matches.
+bool cpu_snapshotPageChanged(const Cpu *cpu, const CpuSnapshot *snapshot,
+        int page);
+const uint8_t *cpu_snapshotPageData(const CpuSnapshot *snapshot, int page);
+int cpu_saveSnapshot(const CpuSnapshot *snapshot, FILE *f);
+CpuSnapshot *cpu_loadSnapshot(FILE *f);
+
+#endif /* SNAPSHOT_H_INCLUDED_ */
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (4 << 20)
+
+struct _traceWriter {
+    FILE *file;
+    uint64_t cycles;
+    size_t used;
+    bool failed;
+    byte buffer[TRACE_BUFFER_SIZE];
+};
+
+static void trace_flush(TraceWriter *writer);
+static void trace_putWord(byte *buffer, uint64_t value, int size);
+static uint64_t trace_getWord(const byte *buffer, int size);
+
+static void trace_flush(TraceWriter *writer) {
+    if (writer->used && fwrite(writer->buffer, 1, writer->used,
+            writer->file) != writer->used) {
+        writer->failed = true;
+    }
+    writer->used = 0;
+}
+
+// Same little-endian layout as snapshots.
+static void trace_putWord(byte *buffer, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        buffer[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t trace_getWord(const byte *buffer, int size) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t) buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+TraceWriter *trace_open(const char *path, const Cpu *cpu) {
+    TraceWriter *writer = malloc(sizeof(TraceWriter));
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+
+    writer->cycles = cpu->cycles;
+    writer->failed = false;
+
+    memcpy(writer->buffer, TRACE_MAGIC, 8);
+    trace_putWord(writer->buffer + 8, TRACE_VERSION, 2);
+    trace_putWord(writer->buffer + 10, TRACE_RECORD_SIZE, 2);
+    trace_putWord(writer->buffer + 12, writer->cycles, 8);
+    writer->used = TRACE_HEADER_SIZE;
+
+    return writer;
+}
+
+int trace_close(TraceWriter *writer) {
+    trace_flush(writer);
+
+    bool failed = writer->failed;
+    if (fclose(writer->file) != 0) {
+        failed = true;
+    }
+    free(writer);
+
+    return failed ? -1 : 0;
+}
+
+void trace_hook(Cpu *cpu, uint16_t pc, const byte *instruction,
+        void *context) {
+    TraceWriter *writer = context;
+
+    if (writer->used + TRACE_RECORD_SIZE + 8 > TRACE_BUFFER_SIZE) {
+        trace_flush(writer);
+    }
+
+    byte *record = writer->buffer + writer->used;
+    uint64_t elapsed = cpu->cycles - writer->cycles;
+
+    trace_putWord(record, pc, 2);
+    memcpy(record + 2, instruction, 3);
+    record[5] = cpu->acc;
+    record[6] = cpu->x;
+    record[7] = cpu->y;
+    record[8] = cpu_getStatus(cpu);
+    trace_putWord(record + 9, cpu->sp, 2);
+    trace_putWord(record + 11, cpu->pc, 2);
+    writer->used += TRACE_RECORD_SIZE;
+
+    if (elapsed < TRACE_CYCLES_FULL) {
+        record[13] = elapsed;
+    } else {
+        record[13] = TRACE_CYCLES_FULL;
+        trace_putWord(record + TRACE_RECORD_SIZE, cpu->cycles, 8);
+        writer->used += 8;
+    }
+    writer->cycles = cpu->cycles;
+}
+
+int trace_openReader(TraceReader *reader, FILE *f) {
+    byte header[TRACE_HEADER_SIZE];
+
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)
+            || memcmp(header, TRACE_MAGIC, 8) != 0
+            || trace_getWord(header + 8, 2) != TRACE_VERSION
+            || trace_getWord(header + 10, 2) != TRACE_RECORD_SIZE) {
+        return -1;
+    }
+
+    reader->file = f;
+    reader->cycles = trace_getWord(header + 12, 8);
+    return 0;
+}
+
+int trace_read(TraceReader *reader, TraceRecord *record) {
+    byte data[TRACE_RECORD_SIZE];
+    size_t sz = fread(data, 1, sizeof(data), reader->file);
+
+    if (sz == 0 && feof(reader->file)) {
+        return 0;
+    }
+    if (sz != sizeof(data)) {
+        return -1;
+    }
+
+    record->pc = trace_getWord(data, 2);
+    memcpy(record->instruction, data + 2, 3);
+    record->acc = data[5];
+    record->x = data[6];
+    record->y = data[7];
+    record->status = data[8];
+    record->sp = trace_getWord(data + 9, 2);
+    record->nextPc = trace_getWord(data + 11, 2);
+
+    if (data[13] == TRACE_CYCLES_FULL) {
+        byte cycles[8];
+
+        if (fread(cycles, 1, sizeof(cycles), reader->file)
+                != sizeof(cycles)) {
+            return -1;
+        }
+        reader->cycles = trace_getWord(cycles, 8);
+    } else {
+        reader->cycles += data[13];
+    }
+    record->cycles = reader->cycles;
+
+    return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H_INCLUDED_
+#define TRACE_H_INCLUDED_
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define TRACE_MAGIC "6502TRCE"
+#define TRACE_VERSION 1
+// Magic, version, record size, then the cycle count tracing started at.
+#define TRACE_HEADER_SIZE (8 + 2 + 2 + 8)
+// PC, the three instruction bytes, A X Y P, SP and PC after the
+// instruction, then the cycles it took. A cycle byte of TRACE_CYCLES_FULL
+// is followed by the full 8-byte cycle count instead, for jumps in the
+// count (a snapshot restore, say) that don't fit in a byte.
+#define TRACE_RECORD_SIZE (2 + 3 + 4 + 2 + 2 + 1)
+#define TRACE_CYCLES_FULL 0xff
+
+// One executed instruction, with the registers as they were after it.
+typedef struct _traceRecord {
+    uint16_t pc;
+    byte instruction[3];
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t status;
+    uint16_t sp;
+    uint16_t nextPc;
+    uint64_t cycles;
+} TraceRecord;
+
+// Streams records to a file through a large buffer. Install trace_hook
+// with the writer as its context:
+//
+//   TraceWriter *trace = trace_open("run.trace", &cpu);
+//   cpu_setTraceHook(&cpu, trace_hook, trace);
+typedef struct _traceWriter TraceWriter;
+
+TraceWriter *trace_open(const char *path, const Cpu *cpu);
+int trace_close(TraceWriter *writer);
+void trace_hook(Cpu *cpu, uint16_t pc, const byte *instruction,
+        void *context);
+
+// Reads a trace back. trace_read returns 1 per record, 0 at the end and -1
+// on a truncated or unreadable file.
+typedef struct _traceReader {
+    FILE *file;
+    uint64_t cycles;
+} TraceReader;
+
+int trace_openReader(TraceReader *reader, FILE *f);
+int trace_read(TraceReader *reader, TraceRecord *record);
+
+#endif /* TRACE_H_INCLUDED_ */
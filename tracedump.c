@@ -0,0 +1,71 @@
+/*
+ * Renders a binary trace written by trace_hook (main -T) as the same text
+ * cpu_debugTrace prints while running.
+ *
+ *   cc -O2 -o tracedump tracedump.c trace.c cpu.c disasm.c
+ *   ./tracedump [-v] run.trace
+ *
+ * -v adds the address and cycle count of each instruction.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+int main(int argc, char *argv[]) {
+    static Cpu cpu;
+    bool verbose = false;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+        verbose = true;
+        arg++;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-v] trace\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[arg], "rb");
+    if (!f) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    TraceReader reader;
+    if (trace_openReader(&reader, f) < 0) {
+        fprintf(stderr, "%s: not a trace file\n", argv[arg]);
+        fclose(f);
+        return 1;
+    }
+
+    // cpu_debugTrace only looks at the registers, so a Cpu that holds the
+    // recorded ones renders exactly what a live run would have printed.
+    cpu_initialize(&cpu);
+
+    TraceRecord record;
+    int status;
+    while ((status = trace_read(&reader, &record)) > 0) {
+        cpu.acc = record.acc;
+        cpu.x = record.x;
+        cpu.y = record.y;
+        cpu_setStatus(&cpu, record.status);
+        cpu.sp = record.sp;
+        cpu.pc = record.nextPc;
+        cpu.cycles = record.cycles;
+
+        if (verbose) {
+            printf("$%04x @%llu\n", record.pc,
+                    (unsigned long long) record.cycles);
+        }
+        cpu_debugTrace(&cpu, record.pc, record.instruction, NULL);
+    }
+    fclose(f);
+
+    if (status < 0) {
+        fprintf(stderr, "%s: truncated trace\n", argv[arg]);
+        return 1;
+    }
+
+    return 0;
+}